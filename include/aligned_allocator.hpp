@@ -0,0 +1,76 @@
+/** An allocator returning page-aligned memory
+
+    OpenCL implementations can use host memory directly, without any
+    copy, only when it is suitably aligned, typically on a page for
+    CL_MEM_USE_HOST_PTR. This allocator can be used with std::vector to
+    get such memory.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_ALIGNED_ALLOCATOR_HPP
+#define HETEROGENEOUS_EXAMPLES_ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace memory {
+
+/// The page size on usual architectures
+constexpr std::size_t page_size = 4096;
+
+
+/// Round some size up to a multiple of some alignment
+constexpr std::size_t round_up(std::size_t size, std::size_t alignment) {
+  return (size + alignment - 1)/alignment*alignment;
+}
+
+
+/** A standard allocator aligning the memory on Alignment bytes
+
+    The size of the allocation is also rounded up to a multiple of the
+    alignment, since some implementations require it for zero-copy
+    buffers.
+*/
+template <typename T, std::size_t Alignment = page_size>
+struct aligned_allocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = aligned_allocator<U, Alignment>;
+  };
+
+  aligned_allocator() = default;
+
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U, Alignment> &) {}
+
+  T *allocate(std::size_t n) {
+    void *p;
+    if (posix_memalign(&p, Alignment, round_up(n*sizeof(T), Alignment)))
+      throw std::bad_alloc {};
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, std::size_t) {
+    std::free(p);
+  }
+};
+
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const aligned_allocator<T, Alignment> &,
+                const aligned_allocator<U, Alignment> &) {
+  return true;
+}
+
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const aligned_allocator<T, Alignment> &,
+                const aligned_allocator<U, Alignment> &) {
+  return false;
+}
+
+}
+
+#endif
@@ -0,0 +1,302 @@
+/** Small benchmark harness shared by the examples
+
+    It runs some operation over a sweep of problem sizes, with some
+    warm-up runs and some timed repetitions, and reports the median and
+    99th percentile of the latency along with the effective bandwidth,
+    split into transfer and kernel time, as CSV or JSON.
+
+    Header-only to keep the build of each example as a single
+    translation unit.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_BENCHMARK_HPP
+#define HETEROGENEOUS_EXAMPLES_BENCHMARK_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace benchmark {
+
+/// The clock used for all the host-side measurements
+using clock = std::chrono::steady_clock;
+
+
+/// Seconds elapsed between 2 time points
+inline double seconds(clock::time_point start, clock::time_point end) {
+  return std::chrono::duration<double> { end - start }.count();
+}
+
+
+/** The timing of 1 run of an operation
+
+    transfer is the time spent moving data between the host and the
+    device, kernel is the time spent computing. For a pure host
+    implementation everything is in kernel.
+*/
+struct sample {
+  double transfer = 0;
+  double kernel = 0;
+
+  double total() const { return transfer + kernel; }
+};
+
+
+/// Measure the time spent in some code and accumulate it into a counter
+class stopwatch {
+  double &accumulator;
+  clock::time_point start = clock::now();
+
+public:
+
+  stopwatch(double &accumulator) : accumulator { accumulator } {}
+
+  ~stopwatch() { accumulator += seconds(start, clock::now()); }
+};
+
+
+/** Parse a size with an optional binary suffix such as "1Ki", "64Mi"
+    or "1Gi" */
+inline std::size_t parse_size(const std::string &s) {
+  std::size_t end;
+  auto value = std::stoull(s, &end);
+  auto suffix = s.substr(end);
+  if (suffix.empty())
+    return value;
+  if (suffix == "Ki")
+    return value << 10;
+  if (suffix == "Mi")
+    return value << 20;
+  if (suffix == "Gi")
+    return value << 30;
+  throw std::invalid_argument { "Unknown size suffix in " + s };
+}
+
+
+/// Split a comma-separated list
+inline std::vector<std::string> split(const std::string &s) {
+  std::vector<std::string> r;
+  std::istringstream is { s };
+  for (std::string item; std::getline(is, item, ',');)
+    if (!item.empty())
+      r.push_back(item);
+  return r;
+}
+
+
+/** Split a command-line option "--key=value" into its key and its
+    value, which is empty without any '=' */
+inline std::pair<std::string, std::string>
+split_option(const std::string &arg) {
+  auto equal = arg.find('=');
+  if (equal == std::string::npos)
+    return { arg, "" };
+  return { arg.substr(0, equal), arg.substr(equal + 1) };
+}
+
+
+/// The command-line options common to all the benchmarks
+struct options {
+  // The smallest problem size, in elements
+  std::size_t min_size = std::size_t { 1 } << 10;
+  /* The biggest problem size, in elements. 3 vectors of 256 MiB of
+     floats fit in the memory of an ordinary machine */
+  std::size_t max_size = std::size_t { 1 } << 26;
+  // The multiplicative step between 2 problem sizes
+  std::size_t factor = 4;
+  // Number of untimed runs before the measurements
+  int warmup = 2;
+  // Number of timed runs per problem size
+  int repeat = 10;
+  // "csv" or "json"
+  std::string format = "csv";
+  // The implementations to run, everything available if empty
+  std::vector<std::string> backends;
+  // Options not understood here, for the benchmark itself
+  std::vector<std::string> extra;
+
+  options(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto option = split_option(arg);
+      auto &key = option.first;
+      auto &value = option.second;
+      if (key == "--min")
+        // 0 would never grow with the factor
+        min_size = std::max<std::size_t>(1, parse_size(value));
+      else if (key == "--max")
+        max_size = parse_size(value);
+      else if (key == "--factor")
+        factor = std::max<std::size_t>(2, parse_size(value));
+      else if (key == "--warmup")
+        warmup = std::stoi(value);
+      else if (key == "--repeat")
+        repeat = std::max(1, std::stoi(value));
+      else if (key == "--format")
+        format = value;
+      else if (key == "--backend")
+        backends = split(value);
+      else if (key == "--help") {
+        std::cerr << "Usage: " << argv[0] << R"( [options]
+  --min=SIZE       smallest number of elements (default 1Ki)
+  --max=SIZE       biggest number of elements (default 64Mi)
+  --factor=F       size multiplier between 2 steps (default 4)
+  --warmup=W       untimed runs per size (default 2)
+  --repeat=R       timed runs per size (default 10)
+  --format=F       csv or json (default csv)
+  --backend=A,B    restrict to some implementations
+SIZE accepts the Ki, Mi and Gi suffixes
+)";
+        std::exit(0);
+      }
+      else
+        extra.push_back(arg);
+    }
+    if (format != "csv" && format != "json")
+      throw std::invalid_argument { "Unknown format " + format };
+  }
+
+  /// The list of problem sizes to sweep over
+  std::vector<std::size_t> sizes() const {
+    std::vector<std::size_t> r;
+    for (auto n = min_size; n <= max_size; n *= factor)
+      r.push_back(n);
+    return r;
+  }
+
+  /// Is this implementation selected?
+  bool selected(const std::string &name) const {
+    return backends.empty()
+      || std::find(backends.begin(), backends.end(), name) != backends.end();
+  }
+};
+
+
+/// Some percentile of an unsorted list of values
+inline double percentile(std::vector<double> v, double p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  // Nearest-rank method
+  auto rank = static_cast<std::size_t>(std::ceil(p/100*v.size()));
+  return v[std::max<std::size_t>(rank, 1) - 1];
+}
+
+
+/// The summary of all the timed runs for a given implementation and size
+struct result {
+  std::string backend;
+  std::size_t size;
+  // Bytes moved by the operation between memory and the compute units
+  std::size_t bytes;
+  int repeat;
+  double median;
+  double p99;
+  double median_transfer;
+  double median_kernel;
+
+  result(std::string backend, std::size_t size, std::size_t bytes,
+         const std::vector<sample> &samples)
+    : backend { std::move(backend) }
+    , size { size }
+    , bytes { bytes }
+    , repeat { static_cast<int>(samples.size()) } {
+    std::vector<double> total, transfer, kernel;
+    for (auto &s : samples) {
+      total.push_back(s.total());
+      transfer.push_back(s.transfer);
+      kernel.push_back(s.kernel);
+    }
+    median = percentile(total, 50);
+    p99 = percentile(total, 99);
+    median_transfer = percentile(transfer, 50);
+    median_kernel = percentile(kernel, 50);
+  }
+
+  /// Effective bandwidth in GB/s for some time
+  double bandwidth(double time) const {
+    return time > 0 ? bytes/time*1e-9 : 0;
+  }
+};
+
+
+/** Write the results either as CSV or as JSON
+
+    The results are streamed as soon as they are produced, so a long
+    sweep can be followed or interrupted.
+*/
+class reporter {
+  std::ostream &os;
+  std::string format;
+  bool first = true;
+
+public:
+
+  reporter(std::ostream &os, std::string format)
+    : os { os }, format { std::move(format) } {
+    if (this->format == "csv")
+      os << "backend,size,bytes,repeat,median_s,p99_s,median_transfer_s,"
+            "median_kernel_s,bandwidth_GBps,kernel_bandwidth_GBps"
+         << std::endl;
+    else
+      os << "[";
+  }
+
+  ~reporter() {
+    if (format == "json")
+      os << std::endl << "]" << std::endl;
+  }
+
+  void operator()(const result &r) {
+    if (format == "csv")
+      os << r.backend << ',' << r.size << ',' << r.bytes << ','
+         << r.repeat << ',' << r.median << ',' << r.p99 << ','
+         << r.median_transfer << ',' << r.median_kernel << ','
+         << r.bandwidth(r.median) << ',' << r.bandwidth(r.median_kernel)
+         << std::endl;
+    else {
+      os << (first ? "" : ",") << std::endl
+         << R"(  { "backend": ")" << r.backend
+         << R"(", "size": )" << r.size
+         << R"(, "bytes": )" << r.bytes
+         << R"(, "repeat": )" << r.repeat
+         << R"(, "median_s": )" << r.median
+         << R"(, "p99_s": )" << r.p99
+         << R"(, "median_transfer_s": )" << r.median_transfer
+         << R"(, "median_kernel_s": )" << r.median_kernel
+         << R"(, "bandwidth_GBps": )" << r.bandwidth(r.median)
+         << R"(, "kernel_bandwidth_GBps": )" << r.bandwidth(r.median_kernel)
+         << " }" << std::flush;
+    }
+    first = false;
+  }
+};
+
+
+/** Run an operation with warm-up and timed repetitions
+
+    \param[in] run is called with no argument and returns the sample of
+    1 execution
+*/
+inline std::vector<sample> measure(const options &o,
+                                   const std::function<sample()> &run) {
+  for (int i = 0; i < o.warmup; ++i)
+    run();
+  std::vector<sample> samples;
+  for (int i = 0; i < o.repeat; ++i)
+    samples.push_back(run());
+  return samples;
+}
+
+}
+
+#endif
@@ -0,0 +1,400 @@
+/** Elementwise expressions fused into a single generated OpenCL kernel
+
+    Instead of a hardcoded kernel per operation, which costs a launch
+    and a pass over memory for each operation of a chain, an expression
+    such as
+
+      c = a + b*k - d;
+
+    on device vectors builds an expression template, which generates
+    the source of 1 kernel reading each input once and writing each
+    output once. Several outputs can even be computed by the same
+    kernel with evaluate().
+
+    The scalars are kernel arguments and not literals, so the source of
+    the kernel depends only on the shape of the expression. The kernels
+    are built by ocl::runtime, which keeps them by source, and the
+    binaries go to the on-disk program cache, so each expression
+    signature is compiled only once.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_FUSED_EXPRESSION_HPP
+#define HETEROGENEOUS_EXAMPLES_FUSED_EXPRESSION_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "opencl_runtime.hpp"
+
+namespace fused {
+
+/// The OpenCL C name of the element types
+template <typename T>
+const char *type_name();
+
+template <>
+inline const char *type_name<float>() { return "float"; }
+
+template <>
+inline const char *type_name<double>() { return "double"; }
+
+template <>
+inline const char *type_name<int>() { return "int"; }
+
+
+/// The base of the expressions, to enable the operators only on them
+template <typename E>
+struct expression {
+  const E &self() const { return static_cast<const E &>(*this); }
+};
+
+
+template <typename T>
+class vector;
+
+
+/** The inputs and the outputs of a fused kernel, collected while its
+    source is generated from the expressions
+
+    The same vector used several times is read only once.
+*/
+template <typename T>
+class generator {
+  std::vector<cl_mem> inputs;
+  std::vector<T> scalars;
+  std::vector<cl_mem> outputs;
+  // The loads of the inputs and the stores of the outputs
+  std::ostringstream loads;
+  std::ostringstream stores;
+  std::size_t n = 0;
+  bool sized = false;
+
+  void check_size(std::size_t size) {
+    if (sized && size != n)
+      throw std::invalid_argument { "Vectors of different sizes in a fused "
+          "expression" };
+    n = size;
+    sized = true;
+  }
+
+public:
+
+  /// The private variable holding an element of an input vector
+  std::string input(const vector<T> &v) {
+    check_size(v.size());
+    auto i = std::find(inputs.begin(), inputs.end(), v.get())
+      - inputs.begin();
+    if (i == static_cast<std::ptrdiff_t>(inputs.size())) {
+      inputs.push_back(v.get());
+      loads << "  const " << type_name<T>() << " v" << i << " = in" << i
+            << "[i];\n";
+    }
+    return "v" + std::to_string(i);
+  }
+
+  /// The argument holding a scalar
+  std::string scalar(T value) {
+    scalars.push_back(value);
+    return "s" + std::to_string(scalars.size() - 1);
+  }
+
+  /// Write the value of an expression to an output vector
+  void output(const vector<T> &v, const std::string &code) {
+    check_size(v.size());
+    if (std::find(outputs.begin(), outputs.end(), v.get()) != outputs.end())
+      throw std::invalid_argument { "The same vector is written twice by a "
+          "fused expression" };
+    stores << "  out" << outputs.size() << "[i] = " << code << ";\n";
+    outputs.push_back(v.get());
+  }
+
+  /// The number of work-items
+  std::size_t size() const { return n; }
+
+  /** The source of the kernel, with the inputs, the scalars and the
+      outputs as arguments in this order */
+  std::string source() const {
+    auto t = type_name<T>();
+    std::ostringstream s;
+    if (std::is_same<T, double>::value)
+      s << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+    s << "__kernel void fused(";
+    const char *separator = "";
+    for (std::size_t i = 0; i < inputs.size(); ++i, separator = ", ")
+      s << separator << "const __global " << t << " *in" << i;
+    for (std::size_t i = 0; i < scalars.size(); ++i, separator = ", ")
+      s << separator << "const " << t << " s" << i;
+    for (std::size_t i = 0; i < outputs.size(); ++i, separator = ", ")
+      s << separator << "__global " << t << " *out" << i;
+    s << ") {\n  const size_t i = get_global_id(0);\n"
+      << loads.str() << stores.str() << "}\n";
+    return s.str();
+  }
+
+  /// Set the arguments of the kernel built from source()
+  void set_args(cl_kernel k) const {
+    cl_uint index = 0;
+    for (auto m : inputs)
+      ocl::set_arg(k, index++, m);
+    for (auto s : scalars)
+      ocl::set_arg(k, index++, s);
+    for (auto m : outputs)
+      ocl::set_arg(k, index++, m);
+  }
+};
+
+
+/// Store the vectors by reference in the expressions and the rest by value
+template <typename E>
+struct stored {
+  using type = E;
+};
+
+template <typename T>
+struct stored<vector<T>> {
+  using type = const vector<T> &;
+};
+
+
+/// A scalar operand, passed as a kernel argument
+template <typename T>
+class scalar : public expression<scalar<T>> {
+  T value;
+
+public:
+
+  using value_type = T;
+
+  explicit scalar(T value) : value { value } {}
+
+  std::string code(generator<T> &g) const { return g.scalar(value); }
+};
+
+
+/// An operation on 1 operand, written as Operation(operand)
+template <typename Operation, typename E>
+class unary : public expression<unary<Operation, E>> {
+  typename stored<E>::type e;
+
+public:
+
+  using value_type = typename E::value_type;
+
+  explicit unary(const E &e) : e { e } {}
+
+  std::string code(generator<value_type> &g) const {
+    return Operation::symbol() + std::string { "(" } + e.code(g) + ")";
+  }
+};
+
+
+/// An infix operation on 2 operands
+template <typename Operation, typename L, typename R>
+class binary : public expression<binary<Operation, L, R>> {
+  static_assert(std::is_same<typename L::value_type,
+                             typename R::value_type>::value,
+                "The operands have to be of the same type");
+
+  typename stored<L>::type l;
+  typename stored<R>::type r;
+
+public:
+
+  using value_type = typename L::value_type;
+
+  binary(const L &l, const R &r) : l { l }, r { r } {}
+
+  std::string code(generator<value_type> &g) const {
+    // Generate the left operand first, so the source is deterministic
+    auto left = l.code(g);
+    auto right = r.code(g);
+    return "(" + left + Operation::symbol() + right + ")";
+  }
+};
+
+
+struct plus { static const char *symbol() { return " + "; } };
+struct minus { static const char *symbol() { return " - "; } };
+struct multiplies { static const char *symbol() { return "*"; } };
+struct divides { static const char *symbol() { return "/"; } };
+struct negate { static const char *symbol() { return "-"; } };
+struct square_root { static const char *symbol() { return "sqrt"; } };
+struct exponential { static const char *symbol() { return "exp"; } };
+struct absolute { static const char *symbol() { return "fabs"; } };
+
+
+/* The operators between 2 expressions, or between an expression and a
+   scalar of its type on either side */
+#define FUSED_EXPRESSION_OPERATOR(OPERATOR, OPERATION)                   \
+  template <typename L, typename R>                                     \
+  binary<OPERATION, L, R>                                               \
+  operator OPERATOR(const expression<L> &l, const expression<R> &r) {   \
+    return { l.self(), r.self() };                                      \
+  }                                                                     \
+                                                                        \
+  template <typename L>                                                 \
+  binary<OPERATION, L, scalar<typename L::value_type>>                  \
+  operator OPERATOR(const expression<L> &l,                             \
+                    typename L::value_type r) {                         \
+    return { l.self(), scalar<typename L::value_type> { r } };          \
+  }                                                                     \
+                                                                        \
+  template <typename R>                                                 \
+  binary<OPERATION, scalar<typename R::value_type>, R>                  \
+  operator OPERATOR(typename R::value_type l,                           \
+                    const expression<R> &r) {                           \
+    return { scalar<typename R::value_type> { l }, r.self() };          \
+  }
+
+FUSED_EXPRESSION_OPERATOR(+, plus)
+FUSED_EXPRESSION_OPERATOR(-, minus)
+FUSED_EXPRESSION_OPERATOR(*, multiplies)
+FUSED_EXPRESSION_OPERATOR(/, divides)
+
+#undef FUSED_EXPRESSION_OPERATOR
+
+
+template <typename E>
+unary<negate, E> operator-(const expression<E> &e) {
+  return unary<negate, E> { e.self() };
+}
+
+template <typename E>
+unary<square_root, E> sqrt(const expression<E> &e) {
+  return unary<square_root, E> { e.self() };
+}
+
+template <typename E>
+unary<exponential, E> exp(const expression<E> &e) {
+  return unary<exponential, E> { e.self() };
+}
+
+template <typename E>
+unary<absolute, E> fabs(const expression<E> &e) {
+  return unary<absolute, E> { e.self() };
+}
+
+
+namespace detail {
+
+template <typename T>
+void assign(generator<T> &) {}
+
+template <typename T, typename E, typename... Rest>
+void assign(generator<T> &g, vector<T> &out, const expression<E> &e,
+            Rest &&... rest) {
+  g.output(out, e.self().code(g));
+  assign(g, std::forward<Rest>(rest)...);
+}
+
+}
+
+
+/** Compute some outputs from some expressions with only 1 kernel
+
+    For example evaluate(rt, c, a + b, d, a*b) reads a and b only once
+    to compute both c and d. The expressions are computed from the
+    values of the vectors before the kernel, even if some outputs are
+    also inputs.
+
+    The kernel is only enqueued, reading a vector waits for it.
+
+    \param[in] outputs_and_expressions are pairs of an output vector and
+    an expression
+*/
+template <typename T, typename E, typename... Rest>
+void evaluate(ocl::runtime &rt, vector<T> &out, const expression<E> &e,
+              Rest &&... outputs_and_expressions) {
+  generator<T> g;
+  detail::assign(g, out, e,
+                 std::forward<Rest>(outputs_and_expressions)...);
+  if (!g.size())
+    return;
+  // Built only on the first use of this expression signature
+  auto k = rt.kernel(g.source(), "fused");
+  g.set_args(k);
+  const std::size_t global_work_size { g.size() };
+  ocl::check(clEnqueueNDRangeKernel(rt.queue(), k, 1, NULL,
+                                    &global_work_size, NULL, 0, NULL,
+                                    ocl::profile("fused")),
+             "clEnqueueNDRangeKernel");
+}
+
+
+/// A vector in device memory, which is the leaf of the expressions
+template <typename T>
+class vector : public expression<vector<T>> {
+  ocl::runtime *rt;
+  std::size_t n;
+  ocl::mem buffer;
+
+public:
+
+  using value_type = T;
+
+  /// An uninitialized vector of n elements
+  vector(ocl::runtime &rt, std::size_t n)
+    : rt { &rt }
+    , n { n }
+    , buffer { ocl::create_buffer(rt.context(), CL_MEM_READ_WRITE,
+                                  n*sizeof(T)) } {}
+
+  /// A vector initialized from n elements of the host
+  vector(ocl::runtime &rt, const T *host, std::size_t n)
+    : vector { rt, n } {
+    write(host);
+  }
+
+  /** A copy of the elements of another vector in a new buffer, as with
+      the assignment, instead of sharing its buffer */
+  vector(const vector &other) : vector { *other.rt, other.n } {
+    evaluate(*rt, *this, other);
+  }
+
+  vector(vector &&) = default;
+
+  /// Evaluate an expression into the vector with a fused kernel
+  template <typename E>
+  vector &operator=(const expression<E> &e) {
+    evaluate(*rt, *this, e);
+    return *this;
+  }
+
+  /// Copy the elements of another vector, as an expression
+  vector &operator=(const vector &other) {
+    evaluate(*rt, *this, other);
+    return *this;
+  }
+
+  std::string code(generator<T> &g) const { return g.input(*this); }
+
+  /// Copy the elements from the host
+  void write(const T *host) {
+    ocl::check(clEnqueueWriteBuffer(rt->queue(), buffer, CL_TRUE, 0,
+                                    n*sizeof(T), host, 0, NULL,
+                                    ocl::profile("write")),
+               "clEnqueueWriteBuffer");
+  }
+
+  /// Copy the elements to the host, after the pending computations
+  void read(T *host) const {
+    ocl::check(clEnqueueReadBuffer(rt->queue(), buffer, CL_TRUE, 0,
+                                   n*sizeof(T), host, 0, NULL,
+                                   ocl::profile("read")),
+               "clEnqueueReadBuffer");
+  }
+
+  std::size_t size() const { return n; }
+
+  cl_mem get() const { return buffer; }
+};
+
+}
+
+#endif
@@ -0,0 +1,310 @@
+/** Elementwise binary operations on float arrays with SIMD on the host
+
+    This is the CPU path of the vector addition when there is no
+    accelerator, or when the data are too small to be worth a transfer.
+
+    Each operation has SSE2, AVX2 and AVX-512 implementations compiled
+    in the same translation unit with the target attribute of GCC and
+    Clang, so no special compiler flag is needed, and the best one
+    supported by the processor is chosen at run time from CPUID.
+
+    The output is first aligned on the vector size by a few scalar
+    iterations, so that the main loop writes whole vectors, while the
+    inputs are loaded unaligned since they can be misaligned relative
+    to the output. The last elements are done with masked operations on
+    AVX2 and AVX-512 and with scalar ones on SSE2.
+
+    When the arrays are bigger than the last-level cache, the results
+    are written with non-temporal stores, which bypass the caches: the
+    output is not read back soon anyway and this avoids reading each
+    output line from memory before writing it.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_HOST_SIMD_HPP
+#define HETEROGENEOUS_EXAMPLES_HOST_SIMD_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HOST_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+/// The instruction sets with an implementation
+enum class isa { scalar, sse2, avx2, avx512 };
+
+inline const char *name(isa i) {
+  switch (i) {
+  case isa::sse2: return "sse2";
+  case isa::avx2: return "avx2";
+  case isa::avx512: return "avx512";
+  default: return "scalar";
+  }
+}
+
+
+/// Parse the name of an instruction set
+inline isa parse_isa(const std::string &s) {
+  for (auto i : { isa::scalar, isa::sse2, isa::avx2, isa::avx512 })
+    if (s == name(i))
+      return i;
+  throw std::invalid_argument { "Unknown instruction set " + s };
+}
+
+
+/// Are an instruction set and its registers supported by the processor?
+inline bool supported(isa i) {
+#ifdef HOST_SIMD_X86
+  // This checks CPUID and that the OS saves the registers with XGETBV
+  switch (i) {
+  case isa::sse2: return __builtin_cpu_supports("sse2");
+  case isa::avx2: return __builtin_cpu_supports("avx2");
+  case isa::avx512: return __builtin_cpu_supports("avx512f");
+  default: return true;
+  }
+#else
+  return i == isa::scalar;
+#endif
+}
+
+
+/** The best instruction set of the processor, looked up once
+
+    It can be capped with the HOST_SIMD_ISA environment variable, for
+    example HOST_SIMD_ISA=avx2 to avoid the frequency drop of AVX-512 on
+    some processors. An unknown value is ignored with a warning.
+*/
+inline isa best() {
+  static const isa b = [] {
+    auto cap = isa::avx512;
+    if (auto e = std::getenv("HOST_SIMD_ISA"))
+      try {
+        cap = parse_isa(e);
+      } catch (std::invalid_argument &error) {
+        std::cerr << "Ignoring HOST_SIMD_ISA: " << error.what() << std::endl;
+      }
+    for (auto i : { isa::avx512, isa::avx2, isa::sse2 })
+      if (i <= cap && supported(i))
+        return i;
+    return isa::scalar;
+  }();
+  return b;
+}
+
+
+/// How to write the results
+enum class store {
+  // Non-temporal beyond the last-level cache
+  automatic,
+  // Through the caches
+  temporal,
+  // Bypassing the caches
+  non_temporal
+};
+
+
+/// The size of the last-level cache in bytes, looked up once
+inline std::size_t llc_size() {
+  static const std::size_t s = [] {
+    long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0)
+      size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    // A usual size when the C library does not know
+    return size > 0 ? std::size_t(size) : std::size_t { 8 } << 20;
+  }();
+  return s;
+}
+
+
+/* The operations, with their scalar and vector versions. The vector
+   versions are only compiled for the instruction sets of their target
+   attribute */
+#ifdef HOST_SIMD_X86
+#define HOST_SIMD_OPERATION(NAME, OPERATOR, INTRINSIC)                   \
+  struct NAME {                                                         \
+    float operator()(float a, float b) const { return a OPERATOR b; }   \
+    __m128 operator()(__m128 a, __m128 b) const {                       \
+      return _mm_##INTRINSIC##_ps(a, b);                                \
+    }                                                                   \
+    __attribute__((target("avx2")))                                     \
+    __m256 operator()(__m256 a, __m256 b) const {                       \
+      return _mm256_##INTRINSIC##_ps(a, b);                             \
+    }                                                                   \
+    __attribute__((target("avx512f")))                                  \
+    __m512 operator()(__m512 a, __m512 b) const {                       \
+      return _mm512_##INTRINSIC##_ps(a, b);                             \
+    }                                                                   \
+  }
+#else
+#define HOST_SIMD_OPERATION(NAME, OPERATOR, INTRINSIC)                   \
+  struct NAME {                                                         \
+    float operator()(float a, float b) const { return a OPERATOR b; }   \
+  }
+#endif
+
+HOST_SIMD_OPERATION(plus, +, add);
+HOST_SIMD_OPERATION(minus, -, sub);
+HOST_SIMD_OPERATION(multiplies, *, mul);
+HOST_SIMD_OPERATION(divides, /, div);
+
+#undef HOST_SIMD_OPERATION
+
+
+namespace detail {
+
+/// The plain loop, also used for the heads and the tails
+template <typename Operation>
+void scalar(const float *a, const float *b, float *c, std::size_t n,
+            Operation op) {
+  for (std::size_t i = 0; i < n; ++i)
+    c[i] = op(a[i], b[i]);
+}
+
+
+/** The number of scalar iterations aligning the output on some bytes,
+    or 0 if it cannot be aligned at all */
+inline std::size_t head(const float *c, std::size_t n,
+                        std::size_t alignment) {
+  auto offset = reinterpret_cast<std::uintptr_t>(c) % alignment;
+  if (offset % sizeof(float))
+    return 0;
+  return std::min(n, (alignment - offset) % alignment/sizeof(float));
+}
+
+
+/// Is an address aligned on some bytes?
+inline bool aligned(const float *p, std::size_t alignment) {
+  return reinterpret_cast<std::uintptr_t>(p) % alignment == 0;
+}
+
+#ifdef HOST_SIMD_X86
+
+template <typename Operation>
+__attribute__((target("sse2")))
+void sse2(const float *a, const float *b, float *c, std::size_t n,
+          Operation op, bool non_temporal) {
+  auto i = head(c, n, 16);
+  scalar(a, b, c, i, op);
+  if (non_temporal && aligned(c + i, 16)) {
+    for (; i + 4 <= n; i += 4)
+      _mm_stream_ps(c + i, op(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    // Order the non-temporal stores before the later ones
+    _mm_sfence();
+  }
+  else
+    for (; i + 4 <= n; i += 4)
+      _mm_storeu_ps(c + i, op(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  scalar(a + i, b + i, c + i, n - i, op);
+}
+
+
+template <typename Operation>
+__attribute__((target("avx2")))
+void avx2(const float *a, const float *b, float *c, std::size_t n,
+          Operation op, bool non_temporal) {
+  auto i = head(c, n, 32);
+  scalar(a, b, c, i, op);
+  if (non_temporal && aligned(c + i, 32)) {
+    for (; i + 8 <= n; i += 8)
+      _mm256_stream_ps(c + i,
+                       op(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    _mm_sfence();
+  }
+  else
+    for (; i + 8 <= n; i += 8)
+      _mm256_storeu_ps(c + i,
+                       op(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  if (i < n) {
+    // The lanes below the number of remaining elements
+    auto mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i),
+                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    _mm256_maskstore_ps(c + i, mask,
+                        op(_mm256_maskload_ps(a + i, mask),
+                           _mm256_maskload_ps(b + i, mask)));
+  }
+}
+
+
+template <typename Operation>
+__attribute__((target("avx512f")))
+void avx512(const float *a, const float *b, float *c, std::size_t n,
+            Operation op, bool non_temporal) {
+  auto i = head(c, n, 64);
+  scalar(a, b, c, i, op);
+  if (non_temporal && aligned(c + i, 64)) {
+    for (; i + 16 <= n; i += 16)
+      _mm512_stream_ps(c + i,
+                       op(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+    _mm_sfence();
+  }
+  else
+    for (; i + 16 <= n; i += 16)
+      _mm512_storeu_ps(c + i,
+                       op(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+  if (i < n) {
+    // The masked-out lanes are neither read nor written
+    __mmask16 mask = (1U << (n - i)) - 1;
+    _mm512_mask_storeu_ps(c + i, mask,
+                          op(_mm512_maskz_loadu_ps(mask, a + i),
+                             _mm512_maskz_loadu_ps(mask, b + i)));
+  }
+}
+
+#endif
+
+}
+
+
+/** Compute c[i] = op(a[i], b[i]) on n elements
+
+    \param[in] s chooses the stores, by default non-temporal only when
+    the 3 arrays do not fit in the last-level cache
+
+    \param[in] i is the instruction set to use, which has to be
+    supported
+*/
+template <typename Operation>
+void transform(const float *a, const float *b, float *c, std::size_t n,
+               Operation op, store s = store::automatic, isa i = best()) {
+  auto non_temporal = s == store::non_temporal
+    || (s == store::automatic && 3*n*sizeof(float) > llc_size());
+  switch (i) {
+#ifdef HOST_SIMD_X86
+  case isa::avx512:
+    detail::avx512(a, b, c, n, op, non_temporal);
+    return;
+  case isa::avx2:
+    detail::avx2(a, b, c, n, op, non_temporal);
+    return;
+  case isa::sse2:
+    detail::sse2(a, b, c, n, op, non_temporal);
+    return;
+#endif
+  default:
+    detail::scalar(a, b, c, n, op);
+  }
+}
+
+
+/// Compute c = a + b on n elements, see transform()
+inline void add(const float *a, const float *b, float *c, std::size_t n,
+                store s = store::automatic, isa i = best()) {
+  transform(a, b, c, n, plus {}, s, i);
+}
+
+}
+
+#endif
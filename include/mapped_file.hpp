@@ -0,0 +1,143 @@
+/** Files mapped in memory, to stream arrays bigger than the RAM
+
+    The arrays are accessed in place through mmap(), without reading
+    them into a buffer first. The mapping is advised as sequential and
+    each part can be prefetched with will_need() before being used, for
+    the kernel to read it ahead from the disk, and released with
+    release() once done, so that the resident memory of the process
+    stays bounded by the parts in use whatever the size of the file.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_MAPPED_FILE_HPP
+#define HETEROGENEOUS_EXAMPLES_MAPPED_FILE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace memory {
+
+/// A file mapped in memory, unmapped and closed on destruction
+class mapped_file {
+  int fd = -1;
+  void *address = MAP_FAILED;
+  std::size_t length = 0;
+  bool writable = false;
+
+  /// Throw the error of the last system call, closing the file if open
+  [[noreturn]] void fail(const std::string &what) {
+    auto error = errno;
+    if (fd >= 0)
+      close(fd);
+    throw std::system_error { error, std::generic_category(), what };
+  }
+
+  /// The page-aligned range covering some bytes of the mapping
+  std::pair<char *, std::size_t> pages(std::size_t offset,
+                                       std::size_t size) const {
+    static const std::size_t page = sysconf(_SC_PAGESIZE);
+    if (offset >= length)
+      return { nullptr, 0 };
+    size = std::min(size, length - offset);
+    auto begin = offset/page*page;
+    return { static_cast<char *>(address) + begin, offset + size - begin };
+  }
+
+public:
+
+  /// Map an existing file, read-only or read-write
+  explicit mapped_file(const std::string &path, bool writable = false)
+    : writable { writable } {
+    fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+      fail("Cannot open " + path);
+    struct stat s;
+    if (fstat(fd, &s))
+      fail("Cannot stat " + path);
+    length = s.st_size;
+    map(path);
+  }
+
+  /// Create or truncate a file of some size and map it read-write
+  mapped_file(const std::string &path, std::size_t size)
+    : length { size }, writable { true } {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      fail("Cannot create " + path);
+    // A sparse file, the blocks are allocated when the pages are written
+    if (ftruncate(fd, size))
+      fail("Cannot set the size of " + path);
+    map(path);
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  ~mapped_file() {
+    if (address != MAP_FAILED)
+      munmap(address, length);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  void *data() const { return address == MAP_FAILED ? nullptr : address; }
+
+  std::size_t size() const { return length; }
+
+  /// Ask the kernel to read some bytes ahead, without waiting for them
+  void will_need(std::size_t offset, std::size_t size) const {
+    auto p = pages(offset, size);
+    if (p.second)
+      madvise(p.first, p.second, MADV_WILLNEED);
+  }
+
+  /** Drop some bytes not used anymore from the memory of the process
+
+      The written pages are scheduled to be written back first. They
+      stay in the page cache, which the kernel can reclaim, but they do
+      not count in the resident memory of the process anymore.
+  */
+  void release(std::size_t offset, std::size_t size) const {
+    auto p = pages(offset, size);
+    if (!p.second)
+      return;
+    if (writable)
+      msync(p.first, p.second, MS_ASYNC);
+    madvise(p.first, p.second, MADV_DONTNEED);
+  }
+
+private:
+
+  void map(const std::string &path) {
+    // An empty file cannot be mapped, but it has nothing to access anyway
+    if (!length)
+      return;
+    address = mmap(nullptr, length, PROT_READ | (writable ? PROT_WRITE : 0),
+                   MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
+      fail("Cannot map " + path);
+    madvise(address, length, MADV_SEQUENTIAL);
+  }
+};
+
+
+/// The peak resident memory of the process in bytes
+inline std::size_t peak_rss() {
+  struct rusage u;
+  getrusage(RUSAGE_SELF, &u);
+  // In KiB on Linux
+  return std::size_t(u.ru_maxrss) << 10;
+}
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+/** Auto-tuning of the launch shape of elementwise OpenCL kernels
+
+    The best work-group size, number of vectors per work-item and width
+    of the floatN vectors depend on the device, the kernel and the
+    problem size. Instead of passing NULL as the local size or forcing
+    a fixed one, which can even exceed the maximum work-group size of
+    the device, the candidate shapes are measured once and the fastest
+    one is kept in a small on-disk database.
+
+    The database is a text file with 1 line per kernel, device and
+    problem-size bucket, so later runs load the best shape immediately.
+    It is $OPENCL_TUNING_DB, or by default tuning.db in the directory of
+    the program cache of opencl_program_cache.hpp. Setting
+    OPENCL_TUNING_DB to an empty string keeps the results only in
+    memory.
+
+    The kernels take the shape as the ITEMS and WIDTH macros, from
+    launch_shape::options(), and the local size at the launch.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_OPENCL_AUTOTUNE_HPP
+#define HETEROGENEOUS_EXAMPLES_OPENCL_AUTOTUNE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "opencl_error.hpp"
+#include "opencl_program_cache.hpp"
+
+namespace ocl {
+
+/// How an elementwise kernel is launched on n elements
+struct launch_shape {
+  // The work-group size, 0 to let the runtime choose
+  std::size_t local = 0;
+  // The number of vectors processed by each work-item
+  std::size_t items = 1;
+  // The number of elements of each vector, as in float4
+  std::size_t width = 1;
+
+  /// The build options giving the shape to the kernel
+  std::string options() const {
+    return "-DITEMS=" + std::to_string(items)
+      + " -DWIDTH=" + std::to_string(width);
+  }
+
+  /** The number of work-items for n elements, a multiple of the
+      work-group size
+
+      The elements beyond the last whole vector are left to the kernel.
+  */
+  std::size_t global(std::size_t n) const {
+    auto work_items = std::max<std::size_t>(1, (n/width + items - 1)/items);
+    if (local)
+      work_items = (work_items + local - 1)/local*local;
+    return work_items;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const launch_shape &s) {
+  return os << "local=" << (s.local ? std::to_string(s.local) : "auto")
+            << " items=" << s.items << " width=" << s.width;
+}
+
+
+/// The problem-size bucket of n elements, the power of 2 below it
+inline std::size_t size_bucket(std::size_t n) {
+  std::size_t b = 1;
+  while (b <= n/2)
+    b *= 2;
+  return b;
+}
+
+
+/** The key of a kernel on a device for a problem-size bucket
+
+    The driver version is included since a new driver can change the
+    best shape.
+*/
+inline std::string tuning_key(cl_device_id device, const std::string &kernel,
+                              std::size_t n) {
+  std::ostringstream key;
+  key << detail::device_info(device, CL_DEVICE_VENDOR) << '|'
+      << detail::device_info(device, CL_DEVICE_NAME) << '|'
+      << detail::device_info(device, CL_DRIVER_VERSION) << '|'
+      << kernel << '|' << size_bucket(n);
+  auto k = key.str();
+  // The tabulations and new lines are the separators of the file
+  for (auto &c : k)
+    if (c == '\t' || c == '\n')
+      c = ' ';
+  return k;
+}
+
+
+/** The shapes to try for n elements on a device
+
+    The work-group sizes are powers of 2 up to the maximum of the
+    device, the items go up to 8 and the widths up to 16 as the OpenCL
+    vector types.
+*/
+inline std::vector<launch_shape> tuning_candidates(cl_device_id device,
+                                                   std::size_t n) {
+  std::size_t max_local;
+  check(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                        sizeof(max_local), &max_local, NULL),
+        "clGetDeviceInfo");
+  std::vector<std::size_t> locals { 0 };
+  for (std::size_t l = 16; l <= max_local && l <= 1024; l *= 2)
+    locals.push_back(l);
+  std::vector<launch_shape> c;
+  for (std::size_t width : { 1, 2, 4, 8, 16 })
+    for (std::size_t items : { 1, 2, 4, 8 })
+      for (auto local : locals)
+        // Keep at least 1 whole work-group of work
+        if (n >= width*items*std::max<std::size_t>(1, local))
+          c.push_back({ local, items, width });
+  if (c.empty())
+    c.push_back({});
+  return c;
+}
+
+
+/// The tuned shapes, loaded from and saved to a file
+class tuning_database {
+  std::string path;
+  std::map<std::string, launch_shape> shapes;
+
+  /// Merge the entries of the file, keeping the ones in memory
+  void load() {
+    std::ifstream f { path };
+    for (std::string line; std::getline(f, line);) {
+      auto tab = line.find('\t');
+      if (tab == std::string::npos)
+        continue;
+      std::istringstream values { line.substr(tab + 1) };
+      launch_shape s;
+      if (values >> s.local >> s.items >> s.width)
+        shapes.emplace(line.substr(0, tab), s);
+    }
+  }
+
+public:
+
+  /// The file of the database, empty if it is not persisted
+  static std::string default_path() {
+    if (auto p = std::getenv("OPENCL_TUNING_DB"))
+      return p;
+    auto directory = program_cache_directory();
+    return directory.empty() ? directory : directory + "/tuning.db";
+  }
+
+  explicit tuning_database(const std::string &path = default_path())
+    : path { path } {
+    if (!path.empty())
+      load();
+  }
+
+  /// Look up the shape of a key, if already tuned
+  bool find(const std::string &key, launch_shape &s) const {
+    auto e = shapes.find(key);
+    if (e == shapes.end())
+      return false;
+    s = e->second;
+    return true;
+  }
+
+  /** Keep the shape of a key and save the database
+
+      The file is reloaded first, to keep what other processes have
+      tuned in the meantime, and written to a temporary file renamed
+      over it as for the program cache. Any failure to write is ignored
+      since the database is only an optimization.
+  */
+  void store(const std::string &key, const launch_shape &s) {
+    shapes[key] = s;
+    if (path.empty())
+      return;
+    load();
+    auto slash = path.rfind('/');
+    if (slash != std::string::npos && slash
+        && !detail::make_directories(path.substr(0, slash)))
+      return;
+    auto tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    {
+      std::ofstream f { tmp };
+      for (auto &e : shapes)
+        f << e.first << '\t' << e.second.local << ' ' << e.second.items
+          << ' ' << e.second.width << '\n';
+      if (!f)
+        return;
+    }
+    if (std::rename(tmp.c_str(), path.c_str()))
+      std::remove(tmp.c_str());
+  }
+};
+
+
+/** Get the best shape of a key, tuning it if it is not in the database
+
+    \param[in] measure runs the kernel with a shape and returns its time
+    in seconds. A shape not supported by the device or the kernel can
+    throw an exception and is skipped
+
+    \param[in] retune measures the candidates even if the key is known
+
+    \param[out] tuned tells whether the shape has been measured now
+*/
+template <typename Measure>
+launch_shape tune(tuning_database &db, const std::string &key,
+                  const std::vector<launch_shape> &candidates,
+                  Measure measure, bool retune = false,
+                  bool *tuned = nullptr) {
+  launch_shape best;
+  auto known = db.find(key, best);
+  if (tuned)
+    *tuned = retune || !known;
+  if (known && !retune)
+    return best;
+  auto best_time = std::numeric_limits<double>::infinity();
+  for (auto &s : candidates)
+    try {
+      auto t = measure(s);
+      if (t < best_time) {
+        best_time = t;
+        best = s;
+      }
+    } catch (std::exception &e) {
+      std::clog << "Skipping " << s << ": " << e.what() << std::endl;
+    }
+  if (best_time == std::numeric_limits<double>::infinity())
+    throw std::domain_error { "No launch shape works for " + key };
+  db.store(key, best);
+  return best;
+}
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+/** Error handling for the plain OpenCL C API
+
+    The OpenCL errors are turned into std::domain_error exceptions with
+    the failing call and its position in the source.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_OPENCL_ERROR_HPP
+#define HETEROGENEOUS_EXAMPLES_OPENCL_ERROR_HPP
+
+#include <stdexcept>
+#include <string>
+
+#if defined(__APPLE__)
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/* Transform the value of a given symbol to a string. Since we expect a
+   macro symbol, use a double evaluation... */
+#define _strinG(s) #s
+
+#define _stringifY(s) _strinG(s)
+
+/** Throw a nicer error message in the code by adding the file name and
+    the position */
+#define THROW_ERROR(message)                                            \
+  throw std::domain_error(std::string("In file " __FILE__ " at line "   \
+                                      _stringifY(__LINE__) "\n") + message)
+
+/** Test for an OpenCL error and display a message */
+#define OCL_TEST_ERROR_MSG(status, msg) do {                            \
+    if ((status) !=  CL_SUCCESS)                                        \
+      THROW_ERROR(std::string(msg) + std::to_string(status));           \
+  } while(0)
+
+  /** Do an OpenCL function call and test for execution error */
+#define OCL_ERROR(func) do {                                            \
+    cl_int _st = func;                                                  \
+    if (_st !=  CL_SUCCESS)                                             \
+      THROW_ERROR(_stringifY(func) " returns error " + std::to_string(_st)); \
+  } while(0)
+
+namespace ocl {
+
+/// Throw an error with the name of the failing OpenCL function
+inline void check(cl_int status, const char *function) {
+  if (status != CL_SUCCESS)
+    throw std::domain_error { std::string { function } + " returns error "
+                              + std::to_string(status) };
+}
+
+}
+
+#endif
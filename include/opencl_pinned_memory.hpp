@@ -0,0 +1,179 @@
+/** Page-locked host memory for the transfers with a device
+
+    A transfer from pageable memory, such as a plain std::vector, is
+    done by the OpenCL implementation through its own page-locked
+    staging memory, with an additional copy. A transfer from page-locked
+    memory can be done by DMA directly.
+
+    The pool hands out host memory which is either:
+
+    - alloc_host_ptr: the storage of a buffer created with
+      CL_MEM_ALLOC_HOST_PTR and kept mapped, which is how the usual
+      implementations provide pinned memory;
+
+    - mlock: page-aligned memory locked with mlock(), which needs no
+      OpenCL call but is limited by RLIMIT_MEMLOCK. Without enough
+      limit, the memory is still given but not locked and counted by
+      unpinned().
+
+    The memory is kept by size class and reused by the later requests,
+    since pinning is much more expensive than a normal allocation.
+    pinned_allocator plugs the pool into std::vector.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_OPENCL_PINNED_MEMORY_HPP
+#define HETEROGENEOUS_EXAMPLES_OPENCL_PINNED_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "aligned_allocator.hpp"
+#include "opencl_runtime.hpp"
+
+namespace ocl {
+
+/// A pool of page-locked host memory blocks recycled by size class
+class pinned_pool {
+
+public:
+
+  /// How the memory is page-locked
+  enum class pinning { alloc_host_ptr, mlock };
+
+private:
+
+  /// A block of host memory, with its buffer in alloc_host_ptr mode
+  struct block {
+    std::size_t size_class;
+    mem buffer;
+    bool locked;
+  };
+
+  cl_context context;
+  cl_command_queue queue;
+  pinning mode;
+  std::mutex m;
+  // All the blocks, by host address
+  std::map<void *, block> blocks;
+  // The free blocks for each size class
+  std::map<std::size_t, std::vector<void *>> free;
+  std::size_t not_locked = 0;
+
+  /// Get a new block of some size class
+  void *allocate(std::size_t c) {
+    if (mode == pinning::mlock) {
+      void *p;
+      if (posix_memalign(&p, memory::page_size, c))
+        throw std::bad_alloc {};
+      auto locked = !mlock(p, c);
+      if (!locked)
+        ++not_locked;
+      blocks[p] = { c, {}, locked };
+      return p;
+    }
+    auto b = create_buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                           c);
+    cl_int status;
+    // Mapped for the whole life of the pool
+    auto p = clEnqueueMapBuffer(queue, b, CL_TRUE,
+                                CL_MAP_READ | CL_MAP_WRITE, 0, c, 0, NULL,
+                                NULL, &status);
+    check(status, "clEnqueueMapBuffer");
+    blocks[p] = { c, std::move(b), true };
+    return p;
+  }
+
+public:
+
+  /** Use a context, with a queue to map the buffers in alloc_host_ptr
+      mode */
+  pinned_pool(cl_context context, cl_command_queue queue,
+              pinning mode = pinning::alloc_host_ptr)
+    : context { context }, queue { queue }, mode { mode } {}
+
+  pinned_pool(const pinned_pool &) = delete;
+
+  /// Free all the blocks, which have to be unused
+  ~pinned_pool() {
+    for (auto &b : blocks)
+      if (mode == pinning::mlock) {
+        if (b.second.locked)
+          munlock(b.first, b.second.size_class);
+        std::free(b.first);
+      }
+      else
+        clEnqueueUnmapMemObject(queue, b.second.buffer, b.first, 0, NULL,
+                                NULL);
+    if (mode == pinning::alloc_host_ptr)
+      clFinish(queue);
+  }
+
+  /// Get some page-locked memory, reusing a free block if possible
+  void *acquire(std::size_t size) {
+    auto c = buffer_pool::size_class(size);
+    std::lock_guard<std::mutex> lock { m };
+    auto &list = free[c];
+    if (!list.empty()) {
+      auto p = list.back();
+      list.pop_back();
+      return p;
+    }
+    return allocate(c);
+  }
+
+  /// Give back some memory from acquire()
+  void release(void *p) {
+    std::lock_guard<std::mutex> lock { m };
+    free[blocks.at(p).size_class].push_back(p);
+  }
+
+  /// The number of blocks which could not be locked in mlock mode
+  std::size_t unpinned() const { return not_locked; }
+};
+
+
+/// A standard allocator taking its memory from a pinned_pool
+template <typename T>
+class pinned_allocator {
+  pinned_pool *pool;
+
+  template <typename U>
+  friend class pinned_allocator;
+
+public:
+
+  using value_type = T;
+
+  pinned_allocator(pinned_pool &pool) : pool { &pool } {}
+
+  template <typename U>
+  pinned_allocator(const pinned_allocator<U> &other) : pool { other.pool } {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(pool->acquire(n*sizeof(T)));
+  }
+
+  void deallocate(T *p, std::size_t) {
+    pool->release(p);
+  }
+
+  template <typename U>
+  bool operator==(const pinned_allocator<U> &other) const {
+    return pool == other.pool;
+  }
+
+  template <typename U>
+  bool operator!=(const pinned_allocator<U> &other) const {
+    return pool != other.pool;
+  }
+};
+
+}
+
+#endif
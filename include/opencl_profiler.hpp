@@ -0,0 +1,389 @@
+/** Profiling of the OpenCL commands from their events
+
+    Setting the OPENCL_PROFILE environment variable to a file name, for
+    example
+
+      OPENCL_PROFILE=trace.json ./opencl_vector_add
+
+    creates the command queues with CL_QUEUE_PROFILING_ENABLE and keeps
+    the event of each instrumented write, kernel and read. At each
+    report(), their queued, submit, start and end timestamps are written
+    as a Chrome trace, which can be opened in Perfetto or
+    chrome://tracing, and a summary table per command is displayed on
+    std::clog. This shows whether the time goes into waiting in the
+    queues, into the transfers or into the kernels without any vendor
+    profiler.
+
+    Without the environment variable, the queues are created as usual
+    and the instrumentation only costs a test of a boolean per command:
+    profile() returns a null event pointer for the C API and ignores the
+    events of the C++ wrappers.
+
+    The commands are instrumented by name, the same name being used for
+    the same kind of command, so that the summary aggregates them:
+
+      clEnqueueWriteBuffer(q, b, CL_FALSE, 0, size, p, 0, NULL,
+                           ocl::profile("write a"));
+
+      ocl::profile("kernel", queue.enqueue_task(kernel));
+
+    and main calls ocl::profiler::instance().report() at the end, while
+    the queues still exist. The profiler is a static object destroyed
+    after them, so it only warns about the commands never reported.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_OPENCL_PROFILER_HPP
+#define HETEROGENEOUS_EXAMPLES_OPENCL_PROFILER_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opencl_error.hpp"
+
+namespace ocl {
+
+/// Collect the events of the instrumented commands of the process
+class profiler {
+
+  /// A command enqueued with an event not looked at yet
+  struct pending {
+    std::string name;
+    cl_event event = nullptr;
+  };
+
+public:
+
+  /// The timestamps of a completed command, in ns of the device clock
+  struct record {
+    std::string name;
+    cl_command_type type;
+    // The rank of the command queue in the order of appearance
+    std::size_t queue;
+    cl_ulong queued, submit, start, end;
+  };
+
+private:
+
+  // Where to write the trace, empty when profiling is disabled
+  std::string path;
+  bool on = false;
+  std::mutex m;
+  // A deque keeps the event addresses given to the C API stable
+  std::deque<pending> events;
+  std::vector<record> records;
+  std::map<cl_command_queue, std::size_t> queues;
+  // The commands without timestamps, from a queue without profiling
+  std::size_t unavailable = 0;
+
+  profiler() {
+    if (auto p = std::getenv("OPENCL_PROFILE")) {
+      path = p;
+      on = !path.empty();
+    }
+  }
+
+  /// The name of a command type for the trace categories
+  static const char *category(cl_command_type type) {
+    switch (type) {
+    case CL_COMMAND_NDRANGE_KERNEL:
+    case CL_COMMAND_TASK:
+    case CL_COMMAND_NATIVE_KERNEL:
+      return "kernel";
+    case CL_COMMAND_WRITE_BUFFER:
+    case CL_COMMAND_WRITE_BUFFER_RECT:
+    case CL_COMMAND_WRITE_IMAGE:
+      return "write";
+    case CL_COMMAND_READ_BUFFER:
+    case CL_COMMAND_READ_BUFFER_RECT:
+    case CL_COMMAND_READ_IMAGE:
+      return "read";
+    case CL_COMMAND_COPY_BUFFER:
+    case CL_COMMAND_COPY_BUFFER_RECT:
+    case CL_COMMAND_FILL_BUFFER:
+      return "copy";
+    case CL_COMMAND_MAP_BUFFER:
+    case CL_COMMAND_UNMAP_MEM_OBJECT:
+    case CL_COMMAND_SVM_MAP:
+    case CL_COMMAND_SVM_UNMAP:
+      return "map";
+    default:
+      return "other";
+    }
+  }
+
+  /** The time between 2 timestamps in ns, 0 if they are not ordered as
+      with the implementations not filling all of them */
+  static double elapsed(cl_ulong from, cl_ulong to) {
+    return to > from ? to - from : 0;
+  }
+
+  /// Escape a name for a JSON string
+  static std::string json(const std::string &s) {
+    std::string e;
+    for (auto c : s) {
+      if (c == '"' || c == '\\')
+        e += '\\';
+      if (static_cast<unsigned char>(c) >= ' ')
+        e += c;
+    }
+    return e;
+  }
+
+public:
+
+  /// The profiler of the process, configured from the environment
+  static profiler &instance() {
+    static profiler p;
+    return p;
+  }
+
+  profiler(const profiler &) = delete;
+
+  /// Warn about the commands never reported, without any OpenCL call
+  ~profiler() {
+    if (on && !events.empty())
+      std::cerr << "OpenCL profiling: " << events.size()
+                << " commands never reported" << std::endl;
+  }
+
+  /// Is OPENCL_PROFILE set?
+  bool enabled() const { return on; }
+
+  /// The properties to add to a command queue for clCreateCommandQueue
+  cl_command_queue_properties queue_flags() const {
+    return on ? CL_QUEUE_PROFILING_ENABLE : 0;
+  }
+
+  /** Add profiling if enabled to the properties of a command queue for
+      clCreateCommandQueueWithProperties
+
+      \param[in] properties is the zero-terminated list of pairs to
+      extend, or NULL
+  */
+  std::vector<cl_queue_properties>
+  queue_properties(const cl_queue_properties *properties) const {
+    std::vector<cl_queue_properties> p;
+    bool merged = false;
+    for (; properties && *properties; properties += 2) {
+      p.push_back(properties[0]);
+      p.push_back(properties[1]);
+      if (properties[0] == CL_QUEUE_PROPERTIES) {
+        p.back() |= queue_flags();
+        merged = true;
+      }
+    }
+    if (on && !merged) {
+      p.push_back(CL_QUEUE_PROPERTIES);
+      p.push_back(CL_QUEUE_PROFILING_ENABLE);
+    }
+    p.push_back(0);
+    return p;
+  }
+
+  /** Get the place where an enqueue function stores the event of a
+      command of some name
+
+      The place has to be given to the enqueue function before the next
+      collect().
+  */
+  cl_event *event(const std::string &name) {
+    std::lock_guard<std::mutex> lock { m };
+    events.push_back({ name, nullptr });
+    return &events.back().event;
+  }
+
+  /// Keep an event owned by someone else, which is retained
+  void keep(const std::string &name, cl_event e) {
+    if (!e)
+      return;
+    check(clRetainEvent(e), "clRetainEvent");
+    std::lock_guard<std::mutex> lock { m };
+    events.push_back({ name, e });
+  }
+
+  /** Wait for the kept events and turn them into records
+
+      This has to be called from the thread doing the enqueues, or once
+      they are over.
+  */
+  void collect() {
+    std::lock_guard<std::mutex> lock { m };
+    for (auto &p : events) {
+      if (!p.event)
+        // The enqueue failed
+        continue;
+      record r { p.name };
+      cl_command_queue q;
+      auto status = clWaitForEvents(1, &p.event);
+      if (status == CL_SUCCESS)
+        status = clGetEventInfo(p.event, CL_EVENT_COMMAND_TYPE,
+                                sizeof(r.type), &r.type, NULL);
+      if (status == CL_SUCCESS)
+        status = clGetEventInfo(p.event, CL_EVENT_COMMAND_QUEUE, sizeof(q),
+                                &q, NULL);
+      const std::pair<cl_profiling_info, cl_ulong *> timestamps[] = {
+        { CL_PROFILING_COMMAND_QUEUED, &r.queued },
+        { CL_PROFILING_COMMAND_SUBMIT, &r.submit },
+        { CL_PROFILING_COMMAND_START, &r.start },
+        { CL_PROFILING_COMMAND_END, &r.end },
+      };
+      for (auto &t : timestamps)
+        if (status == CL_SUCCESS)
+          status = clGetEventProfilingInfo(p.event, t.first,
+                                           sizeof(cl_ulong), t.second, NULL);
+      clReleaseEvent(p.event);
+      if (status != CL_SUCCESS) {
+        ++unavailable;
+        continue;
+      }
+      r.queue = queues.emplace(q, queues.size()).first->second;
+      records.push_back(r);
+    }
+    events.clear();
+  }
+
+  /// The completed commands collected so far
+  const std::vector<record> &completed() const { return records; }
+
+  /** Write the collected commands as a Chrome trace
+
+      Each command queue has a track with the execution of its commands
+      and another one with their time from being queued to starting.
+  */
+  void trace(std::ostream &os) const {
+    if (records.empty()) {
+      os << "{\"traceEvents\":[]}\n";
+      return;
+    }
+    auto origin = std::min_element(records.begin(), records.end(),
+                                   [] (auto &a, auto &b) {
+                                     return a.queued < b.queued;
+                                   })->queued;
+    // In µs since the first command, as expected by the trace viewers
+    auto us = [&] (cl_ulong t) { return elapsed(origin, t)*1e-3; };
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    for (auto &q : queues)
+      os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+         << 2*q.second << ",\"args\":{\"name\":\"queue " << q.second
+         << "\"}},\n"
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+         << 2*q.second + 1 << ",\"args\":{\"name\":\"queue " << q.second
+         << " waiting\"}},\n";
+    os << std::fixed << std::setprecision(3);
+    const char *separator = "";
+    for (auto &r : records) {
+      auto name = json(r.name);
+      os << separator << "{\"name\":\"" << name << "\",\"cat\":\""
+         << category(r.type) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+         << 2*r.queue << ",\"ts\":" << us(r.start) << ",\"dur\":"
+         << elapsed(r.start, r.end)*1e-3
+         << ",\"args\":{\"queued_to_submit_us\":"
+         << elapsed(r.queued, r.submit)*1e-3 << ",\"submit_to_start_us\":"
+         << elapsed(r.submit, r.start)*1e-3 << "}},\n"
+         << "{\"name\":\"" << name << "\",\"cat\":\"wait\",\"ph\":\"X\","
+            "\"pid\":0,\"tid\":" << 2*r.queue + 1 << ",\"ts\":"
+         << us(r.queued) << ",\"dur\":" << elapsed(r.queued, r.start)*1e-3
+         << "}";
+      separator = ",\n";
+    }
+    os << "\n]}\n";
+  }
+
+  /** Display a table with, for each command name, the number of
+      commands and their mean times between the timestamps */
+  void summary(std::ostream &os) const {
+    struct total {
+      const char *category;
+      std::size_t count = 0;
+      double queued = 0, submitted = 0, executed = 0;
+    };
+    std::map<std::string, total> totals;
+    double all = 0;
+    for (auto &r : records) {
+      auto &t = totals[r.name];
+      t.category = category(r.type);
+      ++t.count;
+      t.queued += elapsed(r.queued, r.submit);
+      t.submitted += elapsed(r.submit, r.start);
+      t.executed += elapsed(r.start, r.end);
+      all += elapsed(r.start, r.end);
+    }
+    auto flags = os.flags();
+    os << std::left << std::setw(24) << "command" << std::right
+       << std::setw(8) << "type" << std::setw(8) << "count"
+       << std::setw(14) << "queued (us)" << std::setw(14) << "submit (us)"
+       << std::setw(14) << "run (us)" << std::setw(12) << "total (ms)"
+       << std::setw(8) << "%" << std::endl;
+    os << std::fixed << std::setprecision(2);
+    for (auto &n : totals) {
+      auto &t = n.second;
+      os << std::left << std::setw(24) << n.first << std::right
+         << std::setw(8) << t.category << std::setw(8) << t.count
+         << std::setw(14) << t.queued/t.count*1e-3
+         << std::setw(14) << t.submitted/t.count*1e-3
+         << std::setw(14) << t.executed/t.count*1e-3
+         << std::setw(12) << t.executed*1e-6
+         << std::setw(8) << (all ? 100*t.executed/all : 0) << std::endl;
+    }
+    if (unavailable)
+      os << unavailable << " commands without profiling information"
+         << std::endl;
+    os.flags(flags);
+  }
+
+  /// Collect the events and write the trace file and the summary
+  void report() {
+    if (!on)
+      return;
+    collect();
+    std::ofstream f { path };
+    trace(f);
+    if (!f)
+      throw std::runtime_error { "Cannot write the OpenCL trace to "
+                                 + path };
+    summary(std::clog);
+  }
+};
+
+
+/** The event argument of an enqueue function for a command of some
+    name, or NULL when profiling is disabled
+
+    The name is a C string so that no std::string is built when
+    profiling is disabled.
+*/
+inline cl_event *profile(const char *name) {
+  auto &p = profiler::instance();
+  return p.enabled() ? p.event(name) : NULL;
+}
+
+
+/// Profile the command of an event
+inline void profile(const char *name, cl_event e) {
+  auto &p = profiler::instance();
+  if (p.enabled())
+    p.keep(name, e);
+}
+
+
+/** Profile the command of the event of a C++ wrapper, such as the
+    events returned by Boost.Compute, and return the event */
+template <typename Event>
+const Event &profile(const char *name, const Event &e) {
+  profile(name, e.get());
+  return e;
+}
+
+}
+
+#endif
@@ -0,0 +1,223 @@
+/** Persistent cache of OpenCL program binaries
+
+    Building an OpenCL program from source can take much longer than
+    running a short job, and on FPGA it is even prohibitive. This keeps
+    the program binaries on disk, keyed by the device, the driver
+    version, the build options and a hash of the source, so that only
+    the first run pays the compilation.
+
+    The cache directory is $OPENCL_PROGRAM_CACHE_DIR, or by default
+    $XDG_CACHE_HOME/heterogeneous_examples or
+    ~/.cache/heterogeneous_examples. Setting OPENCL_PROGRAM_CACHE_DIR to
+    an empty string disables the cache.
+
+    This is what Boost.Compute does with its own program cache, but for
+    the plain OpenCL C API.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_OPENCL_PROGRAM_CACHE_HPP
+#define HETEROGENEOUS_EXAMPLES_OPENCL_PROGRAM_CACHE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "opencl_error.hpp"
+
+namespace ocl {
+
+namespace detail {
+
+/// Get a string property of a device
+inline std::string device_info(cl_device_id device, cl_device_info info) {
+  std::size_t size;
+  check(clGetDeviceInfo(device, info, 0, NULL, &size), "clGetDeviceInfo");
+  std::string s(size, '\0');
+  check(clGetDeviceInfo(device, info, size, &s[0], NULL), "clGetDeviceInfo");
+  // Remove the final '\0' from the C string
+  return s.c_str();
+}
+
+
+/// 64-bit FNV-1a hash, good enough to name the cache entries
+inline std::uint64_t hash(const std::string &s) {
+  std::uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+/// Create a directory and its parents, like mkdir -p
+inline bool make_directories(const std::string &path) {
+  for (auto slash = path.find('/', 1);; slash = path.find('/', slash + 1)) {
+    auto prefix = path.substr(0, slash);
+    if (mkdir(prefix.c_str(), 0755) && errno != EEXIST)
+      return false;
+    if (slash == std::string::npos)
+      return true;
+  }
+}
+
+}
+
+
+/// The directory of the cache, empty if the cache is disabled
+inline std::string program_cache_directory() {
+  if (auto d = std::getenv("OPENCL_PROGRAM_CACHE_DIR"))
+    return d;
+  if (auto d = std::getenv("XDG_CACHE_HOME"))
+    return std::string { d } + "/heterogeneous_examples";
+  if (auto d = std::getenv("HOME"))
+    return std::string { d } + "/.cache/heterogeneous_examples";
+  return {};
+}
+
+
+/** The key identifying a program binary
+
+    It is also stored in the cache entry to detect hash collisions.
+*/
+inline std::string program_cache_key(cl_device_id device,
+                                     const std::string &source,
+                                     const std::string &options) {
+  std::ostringstream key;
+  key << detail::device_info(device, CL_DEVICE_VENDOR) << '\n'
+      << detail::device_info(device, CL_DEVICE_NAME) << '\n'
+      << detail::device_info(device, CL_DEVICE_VERSION) << '\n'
+      << detail::device_info(device, CL_DRIVER_VERSION) << '\n'
+      << options << '\n'
+      << std::hex << detail::hash(source) << ' ' << source.size() << '\n';
+  return key.str();
+}
+
+
+/** Read a cache entry made of the key, a '\0' and the binary
+
+    \return true if the entry exists and matches the key
+*/
+inline bool read_program_cache_entry(const std::string &path,
+                                     const std::string &key,
+                                     std::string &binary) {
+  std::ifstream f { path, std::ios::binary };
+  if (!f)
+    return false;
+  std::string content { std::istreambuf_iterator<char> { f },
+                        std::istreambuf_iterator<char> {} };
+  if (content.size() <= key.size() || content.compare(0, key.size(), key)
+      || content[key.size()] != '\0')
+    return false;
+  binary = content.substr(key.size() + 1);
+  return true;
+}
+
+
+/** Write the binary of a built program into a cache entry
+
+    The entry is written to a temporary file and then renamed, so that
+    concurrent jobs never see a partial entry. Any failure is silently
+    ignored since the cache is only an optimization.
+*/
+inline void write_program_cache_entry(const std::string &path,
+                                      const std::string &key,
+                                      cl_program program) {
+  std::size_t size;
+  if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size),
+                       &size, NULL) != CL_SUCCESS || size == 0)
+    return;
+  std::vector<unsigned char> binary(size);
+  auto data = binary.data();
+  if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data),
+                       &data, NULL) != CL_SUCCESS)
+    return;
+  auto tmp = path + "." + std::to_string(getpid()) + ".tmp";
+  {
+    std::ofstream f { tmp, std::ios::binary };
+    f.write(key.data(), key.size());
+    f.put('\0');
+    f.write(reinterpret_cast<const char *>(data), size);
+    if (!f)
+      return;
+  }
+  if (std::rename(tmp.c_str(), path.c_str()))
+    std::remove(tmp.c_str());
+}
+
+
+/** Build a program for 1 device, from the cache when possible
+
+    \return a built program to be released by the caller with
+    clReleaseProgram()
+*/
+inline cl_program build_program(cl_context context,
+                                cl_device_id device,
+                                const std::string &source,
+                                const std::string &options = "") {
+  auto directory = program_cache_directory();
+  std::string key, path;
+  if (!directory.empty()) {
+    key = program_cache_key(device, source, options);
+    std::ostringstream name;
+    name << directory << '/' << std::hex << detail::hash(key) << ".clbin";
+    path = name.str();
+
+    std::string binary;
+    if (read_program_cache_entry(path, key, binary)) {
+      auto data = reinterpret_cast<const unsigned char *>(binary.data());
+      auto size = binary.size();
+      cl_int binary_status, status;
+      auto program = clCreateProgramWithBinary(context, 1, &device, &size,
+                                               &data, &binary_status,
+                                               &status);
+      if (status == CL_SUCCESS) {
+        // A program from a binary has still to be built, but it is quick
+        if (binary_status == CL_SUCCESS
+            && clBuildProgram(program, 1, &device, options.c_str(),
+                              NULL, NULL) == CL_SUCCESS)
+          return program;
+        clReleaseProgram(program);
+      }
+      // Otherwise the entry is stale or corrupted, so rebuild it
+    }
+  }
+
+  const char *sources = source.c_str();
+  const std::size_t size = source.size();
+  cl_int status;
+  auto program = clCreateProgramWithSource(context, 1, &sources, &size,
+                                           &status);
+  check(status, "clCreateProgramWithSource");
+  status = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+  if (status != CL_SUCCESS) {
+    // Give the build log to understand what is wrong
+    std::size_t log_size = 0;
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL,
+                          &log_size);
+    std::string log(log_size, '\0');
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size,
+                          &log[0], NULL);
+    clReleaseProgram(program);
+    throw std::domain_error { "clBuildProgram returns error "
+                              + std::to_string(status) + "\n" + log };
+  }
+
+  if (!path.empty() && detail::make_directories(directory))
+    write_program_cache_entry(path, key, program);
+  return program;
+}
+
+}
+
+#endif
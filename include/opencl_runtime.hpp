@@ -0,0 +1,454 @@
+/** A small header-only runtime layer over the plain OpenCL C API
+
+    - RAII handles with reference counting for the OpenCL objects, so
+      nothing is leaked even when an error is thrown;
+
+    - device selection by type and vendor, which can be overridden at run
+      time with some environment variables:
+        OPENCL_DEVICE_TYPE=cpu|gpu|accelerator|all
+        OPENCL_VENDOR=<part of the platform or device vendor name>
+        OPENCL_DEVICE=<part of the device name>
+
+    - a runtime object owning a context and a command queue on 1 device,
+      which builds the programs only once (through the on-disk program
+      cache) and keeps the kernel objects for reuse;
+
+    - the command queue created with profiling when OPENCL_PROFILE is
+      set, see opencl_profiler.hpp;
+
+    - a buffer pool recycling cl_mem allocations by size class, so that a
+      long-running service does not pay an allocation and a release on
+      every call.
+
+    The runtime and its kernels are meant to be used from 1 thread at a
+    time, since OpenCL kernel arguments are shared state. The buffer
+    pool can be used concurrently.
+*/
+
+#ifndef HETEROGENEOUS_EXAMPLES_OPENCL_RUNTIME_HPP
+#define HETEROGENEOUS_EXAMPLES_OPENCL_RUNTIME_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opencl_error.hpp"
+#include "opencl_profiler.hpp"
+#include "opencl_program_cache.hpp"
+
+namespace ocl {
+
+/** Own a reference to an OpenCL object
+
+    Copying retains the object and destruction releases it, like a
+    std::shared_ptr using the OpenCL reference counting.
+*/
+template <typename T,
+          cl_int (CL_API_CALL *Retain)(T),
+          cl_int (CL_API_CALL *Release)(T)>
+class handle {
+  T object = nullptr;
+
+public:
+
+  handle() = default;
+
+  /// Take the ownership of an object returned by a clCreate* function
+  explicit handle(T object) : object { object } {}
+
+  handle(const handle &other) : object { other.object } {
+    if (object)
+      Retain(object);
+  }
+
+  handle(handle &&other) noexcept : object { other.object } {
+    other.object = nullptr;
+  }
+
+  handle &operator=(handle other) noexcept {
+    std::swap(object, other.object);
+    return *this;
+  }
+
+  ~handle() {
+    if (object)
+      Release(object);
+  }
+
+  /// The underlying OpenCL object to be used with the C API
+  T get() const { return object; }
+
+  operator T() const { return object; }
+};
+
+using context = handle<cl_context, clRetainContext, clReleaseContext>;
+using command_queue =
+  handle<cl_command_queue, clRetainCommandQueue, clReleaseCommandQueue>;
+using program = handle<cl_program, clRetainProgram, clReleaseProgram>;
+using kernel = handle<cl_kernel, clRetainKernel, clReleaseKernel>;
+using mem = handle<cl_mem, clRetainMemObject, clReleaseMemObject>;
+using event = handle<cl_event, clRetainEvent, clReleaseEvent>;
+
+
+/// Create a buffer owned by a handle
+inline mem create_buffer(cl_context context, cl_mem_flags flags,
+                         std::size_t size, void *host_ptr = NULL) {
+  cl_int status;
+  mem m { clCreateBuffer(context, flags, size, host_ptr, &status) };
+  check(status, "clCreateBuffer");
+  return m;
+}
+
+
+/// Free some shared virtual memory of a context
+class svm_deleter {
+  cl_context context;
+
+public:
+
+  svm_deleter(cl_context context = nullptr) : context { context } {}
+
+  void operator()(void *p) const {
+    clSVMFree(context, p);
+  }
+};
+
+/// Own some shared virtual memory
+template <typename T>
+using svm_ptr = std::unique_ptr<T, svm_deleter>;
+
+/// Allocate n elements of shared virtual memory
+template <typename T>
+svm_ptr<T> svm_alloc(cl_context context, std::size_t n,
+                     cl_svm_mem_flags flags = CL_MEM_READ_WRITE) {
+  auto p = static_cast<T *>(clSVMAlloc(context, flags, n*sizeof(T), 0));
+  if (!p)
+    throw std::domain_error { "clSVMAlloc cannot allocate memory" };
+  return svm_ptr<T> { p, svm_deleter { context } };
+}
+
+
+/// Set 1 kernel argument, with a special case for the buffer handles
+template <typename T>
+void set_arg(cl_kernel k, cl_uint index, const T &value) {
+  check(clSetKernelArg(k, index, sizeof(value), &value), "clSetKernelArg");
+}
+
+inline void set_arg(cl_kernel k, cl_uint index, const mem &m) {
+  set_arg(k, index, m.get());
+}
+
+/// Set all the kernel arguments in order
+template <typename... Args>
+void set_args(cl_kernel k, const Args &... args) {
+  cl_uint index = 0;
+  // Use an initializer list to expand the argument pack in order
+  (void) std::initializer_list<int> { (set_arg(k, index++, args), 0)... };
+}
+
+
+/// Get a string property of a platform
+inline std::string platform_info(cl_platform_id platform,
+                                 cl_platform_info info) {
+  std::size_t size;
+  check(clGetPlatformInfo(platform, info, 0, NULL, &size),
+        "clGetPlatformInfo");
+  std::string s(size, '\0');
+  check(clGetPlatformInfo(platform, info, size, &s[0], NULL),
+        "clGetPlatformInfo");
+  return s.c_str();
+}
+
+
+/// Get a string property of a device
+inline std::string device_info(cl_device_id device, cl_device_info info) {
+  return detail::device_info(device, info);
+}
+
+
+/// Get a scalar property of a device
+template <typename T>
+T device_info(cl_device_id device, cl_device_info info) {
+  T value;
+  check(clGetDeviceInfo(device, info, sizeof(value), &value, NULL),
+        "clGetDeviceInfo");
+  return value;
+}
+
+
+/// Parse a device type such as "cpu" or "gpu"
+inline cl_device_type parse_device_type(const std::string &type) {
+  if (type == "cpu")
+    return CL_DEVICE_TYPE_CPU;
+  if (type == "gpu")
+    return CL_DEVICE_TYPE_GPU;
+  if (type == "accelerator")
+    return CL_DEVICE_TYPE_ACCELERATOR;
+  if (type == "all")
+    return CL_DEVICE_TYPE_ALL;
+  throw std::invalid_argument { "Unknown device type " + type };
+}
+
+
+/** Find all the devices of some type across all the platforms
+
+    \param[in] vendor restricts to the platforms or devices whose vendor
+    name contains this string, if not empty
+
+    The OPENCL_DEVICE_TYPE, OPENCL_VENDOR and OPENCL_DEVICE environment
+    variables take precedence over the parameters.
+*/
+inline std::vector<cl_device_id> devices(cl_device_type type =
+                                           CL_DEVICE_TYPE_ALL,
+                                         std::string vendor = "") {
+  if (auto t = std::getenv("OPENCL_DEVICE_TYPE"))
+    type = parse_device_type(t);
+  if (auto v = std::getenv("OPENCL_VENDOR"))
+    vendor = v;
+  std::string name;
+  if (auto n = std::getenv("OPENCL_DEVICE"))
+    name = n;
+
+  cl_uint num_platforms;
+  check(clGetPlatformIDs(0, NULL, &num_platforms), "clGetPlatformIDs");
+  std::vector<cl_platform_id> platforms(num_platforms);
+  check(clGetPlatformIDs(num_platforms, platforms.data(), NULL),
+        "clGetPlatformIDs");
+
+  auto contains = [] (const std::string &s, const std::string &part) {
+    return s.find(part) != std::string::npos;
+  };
+  std::vector<cl_device_id> result;
+  for (auto platform : platforms) {
+    cl_uint num_devices;
+    // A platform without any device of this type is not an error here
+    if (clGetDeviceIDs(platform, type, 0, NULL, &num_devices) != CL_SUCCESS)
+      continue;
+    std::vector<cl_device_id> ds(num_devices);
+    check(clGetDeviceIDs(platform, type, num_devices, ds.data(), NULL),
+          "clGetDeviceIDs");
+    auto platform_vendor = platform_info(platform, CL_PLATFORM_VENDOR);
+    for (auto d : ds)
+      if ((vendor.empty() || contains(platform_vendor, vendor)
+           || contains(device_info(d, CL_DEVICE_VENDOR), vendor))
+          && (name.empty() || contains(device_info(d, CL_DEVICE_NAME), name)))
+        result.push_back(d);
+  }
+  return result;
+}
+
+
+/// Find the first device of some type, see devices()
+inline cl_device_id select_device(cl_device_type type = CL_DEVICE_TYPE_ALL,
+                                  const std::string &vendor = "") {
+  auto ds = devices(type, vendor);
+  if (ds.empty())
+    throw std::domain_error { "Cannot find any suitable OpenCL device" };
+  return ds.front();
+}
+
+
+/** A pool of buffers recycled by size class
+
+    The sizes are rounded up to a power of 2, so that a released buffer
+    can be reused by any later request of the same class, at the price
+    of up to twice the memory.
+*/
+class buffer_pool {
+  cl_context context;
+  std::mutex m;
+  // The free buffers for each (flags, size class)
+  std::map<std::pair<cl_mem_flags, std::size_t>, std::vector<mem>> free;
+
+public:
+
+  /// A buffer going back to its pool on destruction
+  class buffer {
+    buffer_pool *pool = nullptr;
+    cl_mem_flags flags = 0;
+    std::size_t size_class = 0;
+    mem m;
+
+    friend class buffer_pool;
+
+    buffer(buffer_pool *pool, cl_mem_flags flags, std::size_t size_class,
+           mem m)
+      : pool { pool }, flags { flags }, size_class { size_class }
+      , m { std::move(m) } {}
+
+  public:
+
+    buffer() = default;
+    buffer(buffer &&) = default;
+
+    buffer &operator=(buffer &&other) {
+      recycle();
+      pool = other.pool;
+      flags = other.flags;
+      size_class = other.size_class;
+      m = std::move(other.m);
+      other.pool = nullptr;
+      return *this;
+    }
+
+    ~buffer() { recycle(); }
+
+    void recycle() {
+      if (pool && m.get())
+        pool->recycle(flags, size_class, std::move(m));
+      pool = nullptr;
+    }
+
+    /// The handle, usable with set_args()
+    const mem &get() const { return m; }
+
+    operator cl_mem() const { return m; }
+  };
+
+  explicit buffer_pool(cl_context context) : context { context } {}
+
+  /// The size really allocated for some requested size
+  static std::size_t size_class(std::size_t size) {
+    std::size_t c = 4096;
+    while (c < size)
+      c *= 2;
+    return c;
+  }
+
+  /** Get a buffer of at least some size, reusing a free one if possible
+
+      Buffers using host memory cannot be recycled, so
+      CL_MEM_USE_HOST_PTR and CL_MEM_COPY_HOST_PTR are not allowed.
+  */
+  buffer acquire(std::size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE) {
+    if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR))
+      throw std::invalid_argument { "Host pointer buffers cannot be pooled" };
+    auto c = size_class(size);
+    {
+      std::lock_guard<std::mutex> lock { m };
+      auto &list = free[{ flags, c }];
+      if (!list.empty()) {
+        auto b = std::move(list.back());
+        list.pop_back();
+        return { this, flags, c, std::move(b) };
+      }
+    }
+    return { this, flags, c, create_buffer(context, flags, c) };
+  }
+
+  /// Release all the free buffers, for example under memory pressure
+  void clear() {
+    std::lock_guard<std::mutex> lock { m };
+    free.clear();
+  }
+
+private:
+
+  void recycle(cl_mem_flags flags, std::size_t size_class, mem b) {
+    std::lock_guard<std::mutex> lock { m };
+    free[{ flags, size_class }].push_back(std::move(b));
+  }
+};
+
+
+/// Set a pooled buffer as a kernel argument, found by set_args()
+inline void set_arg(cl_kernel k, cl_uint index,
+                    const buffer_pool::buffer &b) {
+  set_arg(k, index, b.get());
+}
+
+
+/** A context and a command queue on 1 device, with the programs and
+    kernels built once and reused
+*/
+class runtime {
+  cl_device_id dev;
+  ocl::context ctx;
+  ocl::command_queue q;
+  // The programs by build options and source
+  std::map<std::pair<std::string, std::string>, ocl::program> programs;
+  // The kernels by program and name
+  std::map<std::pair<cl_program, std::string>, ocl::kernel> kernels;
+  // Declared after the context so it is destroyed before it
+  std::unique_ptr<buffer_pool> pool;
+
+public:
+
+  /** Use a given device, with optional queue properties
+
+      Profiling is added to the properties when OPENCL_PROFILE is set.
+  */
+  explicit runtime(cl_device_id device,
+                   const cl_queue_properties *properties = NULL)
+    : dev { device } {
+    cl_int status;
+    ctx = ocl::context { clCreateContext(NULL, 1, &dev, NULL, NULL,
+                                         &status) };
+    check(status, "clCreateContext");
+    auto p = profiler::instance().queue_properties(properties);
+    q = ocl::command_queue {
+      clCreateCommandQueueWithProperties(ctx, dev, p.data(), &status)
+    };
+    check(status, "clCreateCommandQueueWithProperties");
+    pool.reset(new buffer_pool { ctx });
+  }
+
+  /// Use the first device of some type, see select_device()
+  explicit runtime(cl_device_type type = CL_DEVICE_TYPE_ALL,
+                   const std::string &vendor = "")
+    : runtime { select_device(type, vendor) } {}
+
+  cl_device_id device() const { return dev; }
+
+  cl_context context() const { return ctx; }
+
+  cl_command_queue queue() const { return q; }
+
+  /** The pool of buffers of the context
+
+      The pooled buffers have to be released before the runtime.
+  */
+  buffer_pool &buffers() { return *pool; }
+
+  /// Build a program once, through the on-disk program cache
+  cl_program build(const std::string &source,
+                   const std::string &options = "") {
+    auto &p = programs[{ options, source }];
+    if (!p.get())
+      p = ocl::program { build_program(ctx, dev, source, options) };
+    return p;
+  }
+
+  /** Get a kernel from a program source, building it only on first use
+
+      The same kernel object is returned for all the calls, so its
+      arguments persist between the calls.
+  */
+  cl_kernel kernel(const std::string &source, const std::string &name,
+                   const std::string &options = "") {
+    auto p = build(source, options);
+    auto &k = kernels[{ p, name }];
+    if (!k.get()) {
+      cl_int status;
+      k = ocl::kernel { clCreateKernel(p, name.c_str(), &status) };
+      check(status, "clCreateKernel");
+    }
+    return k;
+  }
+
+  /// Wait for all the commands of the queue to complete
+  void finish() {
+    check(clFinish(q), "clFinish");
+  }
+};
+
+}
+
+#endif
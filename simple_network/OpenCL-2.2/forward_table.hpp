@@ -0,0 +1,108 @@
+/** The forwarding table and its incremental updates, shared by the host
+    and the device
+
+    Instead of sending the whole table on every change, the host queues
+    the additions and removals of addresses in a small ring buffer and
+    sends them by batches, so the transfers scale with the churn and not
+    with the table size. A full table is only sent to resynchronize the
+    device.
+*/
+
+#ifndef SIMPLE_NETWORK_FORWARD_TABLE_HPP
+#define SIMPLE_NETWORK_FORWARD_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <xilinx/networking>
+#include <xilinx/util>
+
+namespace forwarding {
+
+using address = xlnx::network::ethernet::address;
+
+/* Use a set implementation with static memory allocation to implement
+   the forwarding table for each address. Store up to 1000
+   addresses, with a lookup in constant time for every packet */
+using table = xlnx::util::set<address, 1000>;
+
+enum class operation : std::uint32_t { add, remove };
+
+/// A change in the forwarding table
+struct delta {
+  address mac;
+  operation op;
+};
+
+
+/// Apply a change to a table
+template <typename Table>
+void apply(Table &t, const delta &d) {
+  if (d.op == operation::add)
+    t.insert(d.mac);
+  else
+    t.erase(d.mac);
+}
+
+
+/// The maximum number of changes sent at once to the device
+constexpr std::uint32_t max_batch = 64;
+
+/** Some changes to send to the device
+
+    Only the first bytes() bytes are meaningful and need to be sent.
+*/
+struct batch {
+  std::uint32_t count = 0;
+  delta deltas[max_batch];
+
+  std::size_t bytes() const {
+    return offsetof(batch, deltas) + count*sizeof(delta);
+  }
+};
+
+
+/// A fixed-size ring buffer of changes waiting to be sent
+template <std::size_t Capacity>
+class ring {
+  delta deltas[Capacity];
+  // The number of changes ever pushed and popped
+  std::size_t head = 0;
+  std::size_t tail = 0;
+
+public:
+
+  /** Queue a change
+
+      \return false if the ring is full and needs to be flushed first
+  */
+  bool push(const delta &d) {
+    if (head - tail == Capacity)
+      return false;
+    deltas[head++ % Capacity] = d;
+    return true;
+  }
+
+  bool push(operation op, address mac) {
+    return push(delta { mac, op });
+  }
+
+  /** Move the oldest changes into a batch
+
+      \return false if there was nothing to move
+  */
+  bool pop(batch &b) {
+    b.count = 0;
+    while (tail != head && b.count != max_batch)
+      b.deltas[b.count++] = deltas[tail++ % Capacity];
+    return b.count;
+  }
+
+  std::size_t size() const { return head - tail; }
+
+  bool empty() const { return head == tail; }
+};
+
+}
+
+#endif
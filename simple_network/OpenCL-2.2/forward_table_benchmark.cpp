@@ -0,0 +1,88 @@
+/** Host micro-benchmark of the forwarding table set
+
+    Fill an xlnx::util::set of Ethernet addresses up to various load
+    factors and measure the lookups per second for addresses in the
+    table and for unknown ones, as the L2 router does for each packet.
+
+    Usage: forward_table_benchmark [lookups per measure]
+
+    Output as CSV with the load factor, the number of elements, the
+    insertions refused because of the bounded probe length, and the
+    lookups/s.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <xilinx/networking>
+#include <xilinx/util>
+
+#include "benchmark.hpp"
+
+using address = xlnx::network::ethernet::address;
+
+// A big enough table to go well beyond the caches
+constexpr std::size_t capacity = 1 << 16;
+using table = xlnx::util::set<address, capacity, capacity>;
+
+static_assert(std::is_trivially_copyable<table>::value,
+              "The table has to be sent with a single copy");
+
+
+/// Count the addresses found in the table, timing the lookups
+std::size_t lookup(const table &t, const std::vector<address> &addresses,
+                   std::size_t lookups, double &time) {
+  std::size_t found = 0;
+  benchmark::stopwatch sw { time };
+  for (std::size_t i = 0; i < lookups; ++i)
+    found += t.count(addresses[i % addresses.size()]);
+  return found;
+}
+
+
+int main(int argc, char *argv[]) {
+  const std::size_t lookups = argc > 1 ? std::stoull(argv[1]) : 1 << 24;
+
+  // Random 48-bit MAC addresses
+  std::mt19937_64 generator { 42 };
+  auto random_address = [&] { return generator() & 0xffffffffffffULL; };
+
+  // Sent to the error output to keep the CSV clean
+  std::cerr << "Table of " << table::capacity() << " slots, "
+            << sizeof(table) << " bytes" << std::endl;
+  std::cout << "load_factor,elements,refused,hit_lookups_per_s,"
+               "miss_lookups_per_s" << std::endl;
+  // Static storage since the table is too big for the stack
+  static table t;
+  for (auto load : { 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 1.0 }) {
+    t.clear();
+    std::vector<address> present, absent;
+    std::size_t refused = 0;
+    while (present.size() + refused < load*table::capacity()) {
+      auto a = random_address();
+      if (t.count(a))
+        continue;
+      if (t.insert(a))
+        present.push_back(a);
+      else
+        ++refused;
+    }
+    while (absent.size() < present.size()) {
+      auto a = random_address();
+      if (!t.count(a))
+        absent.push_back(a);
+    }
+    double hit_time = 0, miss_time = 0;
+    auto hits = lookup(t, present, lookups, hit_time);
+    auto misses = lookup(t, absent, lookups, miss_time);
+    if (hits != lookups || misses != 0)
+      throw std::runtime_error { "Wrong lookup result" };
+    std::cout << t.load_factor() << ',' << t.size() << ',' << refused << ','
+              << lookups/hit_time << ',' << lookups/miss_time << std::endl;
+  }
+}
@@ -0,0 +1,279 @@
+/* A multi-port L2 switch in OpenCL C++ 2.2, generalizing the eth0 to
+   eth1 router of simple_network.cl
+
+   - NUM_PORTS Ethernet ports, each with a receiver and a sender;
+
+   - ROUTER_LANES parallel router lanes, the receivers spreading the
+     packets over the lanes by a hash of their flow;
+
+   - 1 egress pipe per lane and per port, so that no pipe has more than
+     1 writer and 1 reader and the lanes never synchronize with each
+     other;
+
+   - the MAC table maps an address to an egress port bitmask and learns
+     the port of the source addresses.
+
+   The lanes only read the table. They send the addresses to learn to a
+   learner kernel, which updates the copy of the table the lanes are not
+   using and publishes it, as the host updates do in simple_network.cl.
+   So the throughput scales with the number of lanes instead of
+   serializing on a global lock.
+
+   The receivers poll their ports, as eth0_receiver in NAPI mode, so
+   there is no interrupt here.
+
+   The host emulation in ../emulation/l2_switch_emulation.cpp runs the
+   same graph on a CPU to measure the scaling with the number of lanes.
+*/
+
+#include <opencl_atomic>
+#include <opencl_device_queue>
+#include <opencl_memory>
+#include <opencl_pipe>
+#include <opencl_work_item>
+
+/* Some libraries providing functions, classes and built-in RTL
+   kernels to control the platform */
+#include <xilinx/networking>
+#include <xilinx/util>
+
+// The MAC table shared with the host
+#include "switch_table.hpp"
+
+#ifndef NUM_PORTS
+#define NUM_PORTS 4
+#endif
+
+#ifndef ROUTER_LANES
+#define ROUTER_LANES 4
+#endif
+
+#ifndef BURST_SIZE
+#define BURST_SIZE 8
+#endif
+
+#ifndef PIPE_DEPTH
+#define PIPE_DEPTH 2
+#endif
+
+// The number of addresses to learn waiting in each lane
+#ifndef LEARN_DEPTH
+#define LEARN_DEPTH 16
+#endif
+
+static_assert(NUM_PORTS <= switching::max_ports,
+              "Too many ports for the egress port mask");
+
+
+/* This dummy kernel is just here to force programm loading and
+   program-scope object initizalization when it is run.
+
+   The interesting side effect is starting the kernel graphs on the
+   accelerator
+*/
+kernel void force_init() {
+}
+
+
+// Some packets of 1 ingress port moving together
+struct burst {
+  int port;
+  int count;
+  xlnx::network::ethernet::packet packets[BURST_SIZE];
+};
+
+// From each receiver to each lane
+cl::pipe_storage<burst, PIPE_DEPTH> lane_channel[NUM_PORTS][ROUTER_LANES];
+
+// From each lane to each sender, the per-port egress queues
+cl::pipe_storage<burst, PIPE_DEPTH> egress_channel[ROUTER_LANES][NUM_PORTS];
+
+// The addresses to learn from each lane
+cl::pipe_storage<switching::delta, LEARN_DEPTH> learn_channel[ROUTER_LANES];
+
+// The pipes of the Ethernet controllers
+cl::pipe_storage<xlnx::network::ethernet::packet, PIPE_DEPTH*BURST_SIZE>
+  raw_rx[NUM_PORTS], raw_tx[NUM_PORTS];
+
+/* Instantiate the Ethernet interface built-in kernel of each port
+   provided by the DSA and connect them to their pipes */
+xlnx::network::controller::ports<NUM_PORTS> ethernet { raw_rx, raw_tx };
+
+
+// The same spinning pipe operations as in simple_network.cl
+auto blocking_read = [] (auto some_pipe_storage, auto &a_variable) {
+  auto reader = cl::make_pipe<cl::pipe_access::read>(some_pipe_storage);
+  while (!reader.read(a_variable))
+    ;
+};
+
+auto blocking_write = [] (auto some_pipe_storage, auto const &a_variable) {
+  auto writer = cl::make_pipe<cl::pipe_access::write>(some_pipe_storage);
+  while (!writer.write(a_variable))
+    ;
+};
+
+
+/* Start an asynchronous kernel without any argument on some
+   work-items from the device
+
+   Each work-item of the kernels below is an independent instance, for
+   a port or a lane, which is a compute unit on FPGA.
+*/
+struct start_kernel {
+  template <typename Kernel>
+  start_kernel(Kernel k, std::size_t instances = 1) {
+    cl::get_default_device_queue().enqueue_kernel(cl::enqueue_policy::no_wait,
+                                                  { instances },
+                                                  k);
+  }
+};
+
+
+/* 2 copies of the MAC table: the lanes read the one of the last
+   published version while the learner updates the other one */
+switching::table mac_table[2];
+// The last published version, whose copy is version % 2
+cl::atomic_int table_version { 0 };
+// The version used by each lane
+cl::atomic_int lane_version[ROUTER_LANES];
+
+
+/* Receive the packets of a port and spread them over the lanes by
+   flow, each lane getting its own burst */
+kernel void receiver() {
+  int port = cl::get_global_id(0);
+  auto raw = cl::make_pipe<cl::pipe_access::read>(raw_rx[port]);
+  burst out[ROUTER_LANES];
+  for (auto &b : out) {
+    b.port = port;
+    b.count = 0;
+  }
+  for (; /* ever */ ;) {
+    // Take the packets already arrived, up to a burst
+    xlnx::network::ethernet::packet p;
+    for (int i = 0; i < BURST_SIZE && raw.read(p); ++i) {
+      auto &b = out[switching::flow_lane(p.src, p.dest, ROUTER_LANES)];
+      b.packets[b.count++] = p;
+      if (b.count == BURST_SIZE) {
+        blocking_write(lane_channel[port][&b - out], b);
+        b.count = 0;
+      }
+    }
+    // Do not keep the packets waiting for a full burst
+    for (int l = 0; l < ROUTER_LANES; ++l)
+      if (out[l].count) {
+        blocking_write(lane_channel[port][l], out[l]);
+        out[l].count = 0;
+      }
+  }
+}
+
+start_kernel launch_receivers { receiver, NUM_PORTS };
+
+
+/* A router lane, switching the packets of its flows to their egress
+   ports */
+kernel void L2_switch_lane() {
+  int lane = cl::get_global_id(0);
+  // The version of the table used by this lane
+  int version = 0;
+  burst in, out[NUM_PORTS];
+  for (auto &b : out)
+    b.count = 0;
+  for (int port = 0; ; port = (port + 1) % NUM_PORTS) {
+    /* Follow the published table, even when idle since the learner
+       waits for all the lanes before reusing a copy. This is only a
+       relaxed load per iteration */
+    if (table_version.load(cl::memory_order_relaxed) != version) {
+      version = table_version.load(cl::memory_order_acquire);
+      // Tell the learner the previous copy is not read anymore
+      lane_version[lane].store(version, cl::memory_order_release);
+    }
+    // Serve the receivers in turn
+    if (!cl::make_pipe<cl::pipe_access::read>(lane_channel[port][lane])
+           .read(in))
+      continue;
+    auto &t = mac_table[version % 2];
+    for (int i = 0; i < in.count; ++i) {
+      auto &p = in.packets[i];
+      /* Learn the port of the source address. It is just a hint lost
+         if the learner is late, since the next packet of the host
+         will send it again */
+      if (switching::unknown_source(t, p.src, in.port))
+        cl::make_pipe<cl::pipe_access::write>(learn_channel[lane])
+          .write({ p.src, switching::port_mask { 1u } << in.port });
+      auto mask = switching::egress(t, p.dest, in.port, NUM_PORTS);
+      for (int e = 0; e < NUM_PORTS; ++e)
+        if (mask >> e & 1) {
+          out[e].packets[out[e].count++] = p;
+          if (out[e].count == BURST_SIZE) {
+            blocking_write(egress_channel[lane][e], out[e]);
+            out[e].count = 0;
+          }
+        }
+    }
+    for (int e = 0; e < NUM_PORTS; ++e)
+      if (out[e].count) {
+        blocking_write(egress_channel[lane][e], out[e]);
+        out[e].count = 0;
+      }
+  }
+}
+
+start_kernel launch_lanes { L2_switch_lane, ROUTER_LANES };
+
+
+/* Send the packets switched to a port by all the lanes
+
+   Each lane has its own egress pipe, served in turn, so the packets of
+   a flow stay in order.
+*/
+kernel void sender() {
+  int port = cl::get_global_id(0);
+  auto raw = cl::make_pipe<cl::pipe_access::write>(raw_tx[port]);
+  burst b;
+  for (int lane = 0; ; lane = (lane + 1) % ROUTER_LANES)
+    if (cl::make_pipe<cl::pipe_access::read>(egress_channel[lane][port])
+          .read(b))
+      for (int i = 0; i < b.count; ++i)
+        // Wait for some room in the pipe to Ethernet
+        while (!raw.write(b.packets[i]))
+          ;
+}
+
+start_kernel launch_senders { sender, NUM_PORTS };
+
+
+/* The only writer of the MAC table
+
+   Gather the addresses learned by the lanes and apply them to the copy
+   not in use, once no lane reads it anymore. This copy has missed the
+   previous batch applied to the other copy, so apply it first, as a
+   left-right scheme. Then publish the copy with a new version.
+*/
+kernel void learner() {
+  switching::batch previous, current;
+  for (int lane = 0; ; lane = (lane + 1) % ROUTER_LANES) {
+    auto learned = cl::make_pipe<cl::pipe_access::read>(learn_channel[lane]);
+    while (current.count < switching::max_batch
+           && learned.read(current.deltas[current.count]))
+      ++current.count;
+    // Publish a new version once all the lanes have been looked at
+    if (lane != ROUTER_LANES - 1 || !current.count)
+      continue;
+    auto version = table_version.load(cl::memory_order_relaxed);
+    // Wait for all the lanes to use the last version
+    for (auto &v : lane_version)
+      while (v.load(cl::memory_order_acquire) != version)
+        ;
+    auto &t = mac_table[(version + 1) % 2];
+    previous.apply_to(t);
+    current.apply_to(t);
+    table_version.store(version + 1, cl::memory_order_release);
+    previous = current;
+    current.count = 0;
+  }
+}
+
+start_kernel launch_learner { learner };
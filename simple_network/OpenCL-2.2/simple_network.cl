@@ -23,6 +23,11 @@
 #include <xilinx/networking>
 #include <xilinx/util>
 
+// The forwarding table and its updates shared with the host
+#include "forward_table.hpp"
+// The counters of the pipeline read by the host
+#include "telemetry.hpp"
+
 /* This dummy kernel is just here to force programm loading and
    program-scope object initizalization when it is run.
 
@@ -47,13 +52,35 @@ cl::pipe_storage<xlnx::interrupt::descriptor, 1> interrupt_channel;
 */
 xlnx::interrupt::controller interrupt_controller { interrupt_channel };
 
-/* Can store 1 IEEE802 packet
+/* The packets move between the receiver, the router and the sender by
+   bursts, to pay the pipe operations and the control once per burst
+   instead of once per packet, as the DPDK rx/tx bursts do.
+
+   The burst size and the pipe depths can be chosen with the
+   -DBURST_SIZE and -DPIPE_DEPTH build options, the host emulation in
+   ../emulation helping to choose them.
+*/
+#ifndef BURST_SIZE
+#define BURST_SIZE 8
+#endif
+
+// The depth of the burst pipes
+#ifndef PIPE_DEPTH
+#define PIPE_DEPTH 2
+#endif
+
+struct burst {
+  int count;
+  // When eth0_receiver has read the burst, in cycles
+  std::uint64_t received;
+  xlnx::network::ethernet::packet packets[BURST_SIZE];
+};
 
+cl::pipe_storage<burst, PIPE_DEPTH> eth0_packet_channel, eth1_packet_channel;
 
-   In a real application, probably we would not use such a big
-   granularity but this is a simple example. */
-cl::pipe_storage<xlnx::network::ethernet::packet, 1> eth0_packet_channel,
-  eth1_packet_channel, raw_eth0_packet, raw_eth1_packet;
+// The pipes of the Ethernet controllers, holding the same number of packets
+cl::pipe_storage<xlnx::network::ethernet::packet, PIPE_DEPTH*BURST_SIZE>
+  raw_eth0_packet, raw_eth1_packet;
 
 
 /* Some "wires" to start eth0 and eth1 processing from the interrupt
@@ -78,8 +105,13 @@ cl::pipe_storage<std::bool, 1> trigger_eth0_reading, trigger_eth1_writing;
 xlnx::network::controller::eth0 eth0_controller { raw_eth0_packet };
 xlnx::network::controller::eth1 eth1_controller { raw_eth1_packet };
 
+/* The telemetry of the pipeline, each counter being written by only 1
+   kernel */
+telemetry::block stats;
+
+
 /* A function to implement a read on some storage_pipe that waits up
-   to success
+   to success, returning the number of failed tries
 
    Of course it assumes a memory model and an IFP guarantee typical on
    FPGA... Otherwise it could use blocking pipe extension.
@@ -90,14 +122,16 @@ auto blocking_read = [] (auto some_pipe_storage, auto &a_variable) {
   /* By default make_pipe returns a read-access pipe but let's be
      explicit for educational purpose */
   auto reader = cl::make_pipe<cl::pipe_access::read>(some_pipe_storage);
+  std::uint64_t tries = 0;
   // Spin up to successful read
   while (!reader.read(a_variable))
-    ;
+    ++tries;
+  return tries;
 };
 
 
 /* A function to implement a write on some storage_pipe that waits up
-   to success
+   to success, returning the number of failed tries
 
    Of course it assumes a memory model and an IFP guarantee typical on
    FPGA... Otherwise it could use blocking pipe extension.
@@ -108,32 +142,96 @@ auto blocking_write = [] (auto some_pipe_storage, auto const &a_variable) {
   /* By default make_pipe returns a read-access pipe but let's be
      explicit for educational purpose */
   auto writer = cl::make_pipe<cl::pipe_access::write>(some_pipe_storage);
+  std::uint64_t tries = 0;
   // Spin up to successful write
   while (!writer.write(a_variable))
-    ;
+    ++tries;
+  return tries;
 };
 
 
+/* The interrupt coalescing and polling thresholds, which can be
+   chosen with the build options of the same name:
+
+   - 1 trigger is sent to eth0_receiver for COALESCE_PACKETS interrupts
+     or when the oldest pending interrupt is COALESCE_CYCLES dispatcher
+     iterations old, which are cycles on FPGA;
+
+   - in NAPI mode, with NAPI_IDLE_POLLS not 0, eth0_receiver keeps
+     polling its pipe after an interrupt with its interrupts masked, and
+     goes back to the interrupts only after NAPI_IDLE_POLLS empty polls
+     in a row. So under load there is no interrupt round trip at all.
+*/
+#ifndef COALESCE_PACKETS
+#define COALESCE_PACKETS 1
+#endif
+
+#ifndef COALESCE_CYCLES
+#define COALESCE_CYCLES 1000
+#endif
+
+#ifndef NAPI_IDLE_POLLS
+#define NAPI_IDLE_POLLS 0
+#endif
+
+// Set by eth0_receiver while it polls, to mask its interrupts
+cl::atomic_int eth0_polling { 0 };
+
+
 /* A long running kernel that reads the interrupts and dispatch the
    action
 
    This a contrived example to demonstrate how to use interruptions
+
+   The triggers are not sent with blocking writes: when eth0_receiver is
+   stuck behind a full pipe, the dispatcher would wait on its trigger
+   while the eth1 interrupt which would free the pipeline waits behind
+   in the interrupt channel, a deadlock found with the host emulation in
+   ../emulation. So the pending triggers of each device are counted and
+   sent when their pipe has some room.
+
+   The eth0 interrupts are not sent while eth0_receiver is polling, but
+   they are kept so that a packet arrived at the end of the polling is
+   not forgotten.
 */
 kernel void dispatch_interrupt() {
   xlnx::interrupt_descriptor i;
+  int pending_eth0 = 0;
+  int pending_eth1 = 0;
+  // The age of the oldest pending eth0 interrupt
+  int eth0_age = 0;
   for (; /* ever */ ;) {
-    // Wait for the pipe controlled by the interrupt controller
-    blocking_read(interrupt_channel, i);
-    switch (i.source) {
-    case xlnx::device::eth0:
-      // Send a ready signal to eth0_receiver
-      blocking_write(trigger_eth0_reading, true);
-      break;
-    case xlnx::device::eth1:
-      // Send a ready signal to eth1_sender
-      blocking_write(trigger_eth1_writing, true);
-      break;
-    }
+    // Look for a new interrupt from the pipe controlled by the controller
+    if (cl::make_pipe<cl::pipe_access::read>(interrupt_channel).read(i))
+      switch (i.source) {
+      case xlnx::device::eth0:
+        if (!pending_eth0)
+          eth0_age = 0;
+        /* Saturate, since only reaching the coalescing threshold
+           matters and the polling can mask the trigger for ever */
+        if (pending_eth0 < COALESCE_PACKETS)
+          ++pending_eth0;
+        break;
+      case xlnx::device::eth1:
+        ++pending_eth1;
+        break;
+      }
+    // Saturate the age too, to avoid any overflow while masked
+    if (pending_eth0 && eth0_age < COALESCE_CYCLES)
+      ++eth0_age;
+    /* Send a ready signal to eth0_receiver for all the pending
+       interrupts, if enough of them or old enough */
+    if (pending_eth0
+        && !eth0_polling.load(cl::memory_order_acquire)
+        && (pending_eth0 >= COALESCE_PACKETS || eth0_age >= COALESCE_CYCLES)
+        && cl::make_pipe<cl::pipe_access::write>(trigger_eth0_reading)
+             .write(true))
+      pending_eth0 = 0;
+    // Send a ready signal to eth1_sender if possible
+    if (pending_eth1
+        && cl::make_pipe<cl::pipe_access::write>(trigger_eth1_writing)
+             .write(true))
+      --pending_eth1;
   }
 }
 
@@ -163,19 +261,45 @@ struct start_kernel {
 start_kernel launch_interrupt_dispatcher { dispatch_interrupt };
 
 
-/* Read an ethernet packet from eth0 and send it to the forwarder */
+/* Read the bursts of ethernet packets from eth0 and send them to the
+   forwarder
+
+   On an interrupt, read the bursts up to an empty pipe, or in NAPI mode
+   up to NAPI_IDLE_POLLS empty polls in a row.
+*/
 kernel void eth0_receiver() {
+  burst b;
   for (; /* ever */ ;) {
     std::bool unused;
     blocking_read(trigger_eth0_reading, unused);
-    /* Since we have been notified by interruption, we know the pipe
-       from Ethernet is ready, so no need to wait */
-    xlnx::ethernet::packet p;
-    cl::make_pipe<cl::pipe_access::read>(raw_eth0_packet).read(p);
-    // Add some buffering code here for better buffer bloat :-)
-    // [...]
-    // Send a packet to the router
-    blocking_write(eth0_packet_channel, p);
+    ++stats.wakeups;
+    // Mask the interrupts while polling
+    if (NAPI_IDLE_POLLS)
+      eth0_polling.store(1, cl::memory_order_release);
+    auto raw = cl::make_pipe<cl::pipe_access::read>(raw_eth0_packet);
+    for (int idle = 0; idle <= NAPI_IDLE_POLLS;) {
+      /* Take the packets already arrived up to a full burst. After an
+         interrupt there is at least 1 packet, unless it has been taken
+         by a previous burst already */
+      b.count = 0;
+      while (b.count < BURST_SIZE && raw.read(b.packets[b.count]))
+        ++b.count;
+      if (b.count) {
+        b.received = xlnx::util::cycles();
+        stats(telemetry::receiver, telemetry::in) += b.count;
+        // Send the burst to the router
+        stats(telemetry::receiver, telemetry::full_stalls) +=
+          blocking_write(eth0_packet_channel, b);
+        stats(telemetry::receiver, telemetry::out) += b.count;
+        idle = 0;
+      }
+      else {
+        ++stats(telemetry::receiver, telemetry::empty_polls);
+        ++idle;
+      }
+    }
+    // Unmask the interrupts, the ones arrived meanwhile are pending
+    eth0_polling.store(0, cl::memory_order_release);
   }
 }
 
@@ -184,17 +308,28 @@ kernel void eth0_receiver() {
 start_kernel launch_eth0_receiver { eth0_receiver };
 
 
-/* Read an ethernet packet from the forwarder and send it to eth1 */
+/* Read a burst of ethernet packets from the forwarder and send them to
+   eth1 */
 kernel void eth1_sender() {
+  burst b;
   for (; /* ever */ ;) {
-    std::bool unused;
-    blocking_read(trigger_eth1_writing, unused);
-    xlnx::ethernet::packet p;
-    // Wait for a packet to forward
-    blocking_read(eth1_packet_channel, p);
-    /* Since we have been notified by interruption, we know the pipe
-       to Ethernet is ready, so no need to wait */
-    cl::make_pipe<cl::pipe_access::write>(raw_eth1_packet).write(p);
+    // Wait for a burst to forward
+    stats(telemetry::sender, telemetry::empty_polls) +=
+      blocking_read(eth1_packet_channel, b);
+    stats(telemetry::sender, telemetry::in) += b.count;
+    for (int i = 0; i < b.count; ++i) {
+      // Wait for some room in the pipe to Ethernet
+      std::bool unused;
+      stats(telemetry::sender, telemetry::full_stalls) +=
+        blocking_read(trigger_eth1_writing, unused);
+      /* Since we have been notified by interruption, we know the pipe
+         to Ethernet is ready, so no need to wait */
+      cl::make_pipe<cl::pipe_access::write>(raw_eth1_packet)
+        .write(b.packets[i]);
+    }
+    stats(telemetry::sender, telemetry::out) += b.count;
+    stats.latency[telemetry::latency_bucket(xlnx::util::cycles()
+                                            - b.received)] += b.count;
   }
 }
 
@@ -202,55 +337,152 @@ kernel void eth1_sender() {
 // Start the eth1 sender at program level
 start_kernel launch_eth1_sender { eth1_sender };
 
-/* Use a set implementation with static memory allocation to implement
-   the forwarding table for each address. Store up to 10000
-   addresses */
-using forward_t = xlnx::util::set<xlnx::network::ethernet::address, 1000>;
-forward_t forward;
-// A lock to protect the access to the forwarding table
-cl:: atomic_flag forward_lock = ATOMIC_FLAG_INIT;
+using forward_t = forwarding::table;
+
+/* 2 copies of the forwarding table, so that the host can update one
+   while the router keeps using the other one without any lock */
+forward_t forward[2];
+/* Set by the update kernels when the copy they have written is ready
+   to be used, and cleared by the router when it switches to it */
+cl::atomic_int forward_pending { 0 };
+// The copy written last by the update kernels
+int forward_written = 0;
 
 
 // A trivial L2 packet forwarder from eth0 to eth1
 kernel void L2_router() {
-  xlnx::ethernet::packet p;
+  burst in, out;
+  // The copy of the table used by the router
+  int current = 0;
   for (; /* ever */ ;) {
-    blocking_read(eth0_packet_channel, p);
-    /* If the packet is to be forwarded to eth1 according to the
-       destination IEEE802 address, just do it!
-
-       But the global table may be updated by the host at the same
-       time, so acquire a lock on the table first
+    stats(telemetry::router, telemetry::empty_polls) +=
+      blocking_read(eth0_packet_channel, in);
+    stats(telemetry::router, telemetry::in) += in.count;
+    /* Switch to the new table if the host has published one. This is
+       only a relaxed load per burst, the exchange happening only once
+       per update.
+
+       Since the router works on 1 burst at a time, it is not reading
+       the previous copy anymore when it switches, so the updater can
+       reuse it.
     */
-    while(forward_lock.test_and_set())
-      ;
-    //  Is the address in the forward set?
-    std::bool forward_p = forward.count(p.dest);
-    // Release the lock as early as possible
-    forward_lock.clear();
+    if (forward_pending.load(cl::memory_order_relaxed)) {
+      int expected = 1;
+      /* Acquire to see the content of the new table, release so the
+         updater knows the reads of the old one are done */
+      if (forward_pending.compare_exchange_strong(expected, 0,
+                                                  cl::memory_order_acq_rel,
+                                                  cl::memory_order_relaxed)) {
+        current = 1 - current;
+        ++stats.table_switches;
+      }
+    }
+    out.count = 0;
+    out.received = in.received;
+    for (int i = 0; i < in.count; ++i)
+      //  Is the address in the forward set?
+      if (forward[current].count(in.packets[i].dest))
+        out.packets[out.count++] = in.packets[i];
+    stats(telemetry::router, telemetry::dropped) += in.count - out.count;
     // Then do the real forwarding if required
-    if (forward_p)
-      blocking_write(eth1_packet_channel, p);
+    if (out.count)
+      stats(telemetry::router, telemetry::full_stalls) +=
+        blocking_write(eth1_packet_channel, out);
+    stats(telemetry::router, telemetry::out) += out.count;
   }
 }
 
 
-/* Update the forwarding table
+/* The last changes of the table, to bring each copy up to date. It
+   has to hold the changes of the last 2 updates, since a copy misses
+   at most the update made on the other copy */
+constexpr std::uint32_t forward_log_size = 2*forwarding::max_batch;
+forwarding::delta forward_log[forward_log_size];
+// The number of changes received since the start
+std::uint32_t forward_log_head = 0;
+// The number of changes from the log applied to each copy
+std::uint32_t forward_version[2];
+
+
+/* Choose the copy of the table to update
+
+   If the router has not switched to the previous update yet, just take
+   it back to update it again. Otherwise the router now uses the copy
+   written last, so write into the other one.
+
+   The launches of the update kernels are serialized by the host
+   in-order queue.
+*/
+int forward_copy_to_update() {
+  if (!forward_pending.exchange(0, cl::memory_order_acquire))
+    forward_written = 1 - forward_written;
+  return forward_written;
+}
+
+
+/* Publish the new table with a single atomic flag
+
+   The router is never stopped during the update, which is the RCU
+   approach.
+*/
+void publish_forward_table() {
+  forward_pending.store(1, cl::memory_order_release);
+}
+
+
+/* Apply some changes to the forwarding table
+
+   This is the usual way to update the table: only the changes are
+   sent by the host, recorded into the log and applied in place to the
+   copy not used by the router, after the changes it has missed.
+*/
+kernel void apply_forward_deltas(cl::global_ptr<forwarding::batch> batch) {
+  auto w = forward_copy_to_update();
+  auto count = std::min(batch->count, forwarding::max_batch);
+  for (std::uint32_t i = 0; i < count; ++i)
+    forward_log[forward_log_head++ % forward_log_size] = batch->deltas[i];
+  /* After a resynchronization the copy cannot be brought up to date
+     from the log, so start from the other copy, which is only behind by
+     this batch */
+  if (forward_log_head - forward_version[w] > forward_log_size) {
+    forward[w] = forward[1 - w];
+    forward_version[w] = forward_version[1 - w];
+  }
+  for (; forward_version[w] != forward_log_head; ++forward_version[w])
+    forwarding::apply(forward[w],
+                      forward_log[forward_version[w] % forward_log_size]);
+  publish_forward_table();
+}
+
+
+/* Resynchronize the whole forwarding table
 
    Since there is no host-side access to program scope memories or
    pipes, use a proxy-kernel to copy the information from the host
    through a global buffer.
 
-   Using a direct access from the host to program scope buffer would
-   remove the copy and the latency, but how to deal with the lock
-   without launching 2 kernels?
+   This is only needed when the device is out of sync with the host,
+   since apply_forward_deltas() handles the normal updates.
 */
 kernel void update_forward_table(cl::global_ptr<forward_t> new_table) {
-  // Lock the table
-  while(forward_lock.test_and_set())
-    ;
-  // Massive update
-  forward = *new_table;
-  // Release the lock
-  forward_lock.clear();
+  auto w = forward_copy_to_update();
+  // Massive update, while the router keeps forwarding
+  forward[w] = *new_table;
+  // The full table includes all the changes sent before
+  forward_version[w] = forward_log_head;
+  // Force the other copy to start from this one on its next update
+  forward_version[1 - w] = forward_log_head - forward_log_size - 1;
+  publish_forward_table();
+}
+
+
+/* Copy the telemetry for the host
+
+   Since there is no host-side access to program scope memories, use a
+   proxy-kernel as for the forwarding table. The kernels keep counting
+   meanwhile, so the copy is not an atomic snapshot, which does not
+   matter for monitoring.
+*/
+kernel void read_telemetry(cl::global_ptr<telemetry::block> copy) {
+  *copy = stats;
 }
@@ -1,13 +1,26 @@
 /** Host part of the simple networking application
 
     This starts the L2 forwarding application and loop on updating the
-    forwarding table according to some external user-interface.
+    forwarding table according to some external user-interface, while
+    displaying the telemetry of the device every second.
+
+    With OPENCL_PROFILE=trace.json, the commands sent by the host are
+    profiled too and the trace is rewritten every second, see
+    opencl_profiler.hpp.
  */
 
+#include <chrono>
+#include <iostream>
+
 #include <boost/compute.hpp>
 #include <xilinx/networking>
 #include <xilinx/util>
 
+#include "benchmark.hpp"
+#include "forward_table.hpp"
+#include "opencl_profiler.hpp"
+#include "telemetry_report.hpp"
+
 /* This is an imaginary user interface to command the system to be
    implemented
 */
@@ -15,9 +28,17 @@ class user_interface {
 
 public:
 
-  template <typename T>
-  void update(T &forward) {
-    // [...] Update the forwarding table somehow...
+  /// Queue the changes of the forwarding table, if any
+  template <typename Ring>
+  void update(Ring &deltas) {
+    // [...] Add or remove some addresses somehow, for example with
+    // deltas.push(forwarding::operation::add, some_mac_address);
+  }
+
+  /// Does the device need the full table, for example after a reset?
+  bool resync() {
+    // [...]
+    return false;
   }
 
 };
@@ -28,8 +49,11 @@ user_interface ux;
 int main() {
   // Create the OpenCL context to attach resources on the device
   auto context = boost::compute::system::default_context();
-  // Create the OpenCL command queue to control the device
-  auto command_queue = boost::compute::system::default_queue();
+  /* Create the OpenCL command queue to control the device, with
+     profiling if requested */
+  boost::compute::command_queue command_queue {
+    context, context.get_device(), ocl::profiler::instance().queue_flags()
+  };
 
   /* Create a device default queue so a kernel can enqueue another kernel.
 
@@ -60,25 +84,73 @@ int main() {
 
   /* Launch force_init kernel with 1 work-item, forcing the
      initialization of the program-scope objects */
-  command_queue.enqueue_task(force_init);
+  ocl::profile("force_init", command_queue.enqueue_task(force_init));
 
   auto update = boost::compute::kernel { program, "update_forward_table" };
+  auto apply = boost::compute::kernel { program, "apply_forward_deltas" };
 
-  // The forwarding table
-  xlnx::util::set<xlnx::network::ethernet::address, 1000> forward;
+  // The host copy of the forwarding table, only sent for a resync
+  forwarding::table forward;
   // And the buffer to send it to the device
   boost::compute::buffer fb { context, sizeof(forward), CL_MEM_READ_ONLY };
   // The update_forward_table kernel will take this buffer
   update.set_args(fb);
 
+  // The changes waiting to be sent to the device
+  forwarding::ring<256> deltas;
+  // The changes sent at once and their buffer
+  forwarding::batch batch;
+  boost::compute::buffer db { context, sizeof(batch), CL_MEM_READ_ONLY };
+  apply.set_args(db);
+
+  // The telemetry block copied by the device
+  auto read_telemetry = boost::compute::kernel { program, "read_telemetry" };
+  boost::compute::buffer tb { context, sizeof(telemetry::block),
+                              CL_MEM_WRITE_ONLY };
+  read_telemetry.set_args(tb);
+  // The last snapshot, to display only what happened since then
+  telemetry::block previous {}, current;
+  auto last = benchmark::clock::now();
+
   for (; /* ever */ ;) {
-    // Get some forwarding update from some external user interface...
-    ux.update(forward);
-    // Send the forwarding table top the accelerator
-    command_queue.enqueue_write_buffer(fb, 0 /* Offset */,
-                                       sizeof(forward), &forward);
-    /* Launch the update_forward_table kernel with 1 work-item to lock
-       and update the table on the device */
-    command_queue.enqueue_task(update);
+    // Get some forwarding updates from some external user interface...
+    ux.update(deltas);
+    while (deltas.pop(batch)) {
+      // Keep the host copy up to date for a later resync
+      for (std::uint32_t i = 0; i < batch.count; ++i)
+        forwarding::apply(forward, batch.deltas[i]);
+      // Send only the changes to the accelerator
+      ocl::profile("write deltas",
+                   command_queue.enqueue_write_buffer(db, 0 /* Offset */,
+                                                      batch.bytes(), &batch));
+      /* Launch the apply_forward_deltas kernel with 1 work-item to
+         update the table on the device without stopping the router */
+      ocl::profile("apply_forward_deltas", command_queue.enqueue_task(apply));
+    }
+    if (ux.resync()) {
+      // Send the whole forwarding table to the accelerator
+      ocl::profile("write table",
+                   command_queue.enqueue_write_buffer(fb, 0 /* Offset */,
+                                                      sizeof(forward),
+                                                      &forward));
+      ocl::profile("update_forward_table",
+                   command_queue.enqueue_task(update));
+    }
+    auto now = benchmark::clock::now();
+    if (now - last >= std::chrono::seconds { 1 }) {
+      // Ask the device for a copy of its telemetry and display it
+      ocl::profile("read_telemetry kernel",
+                   command_queue.enqueue_task(read_telemetry));
+      ocl::profile("read telemetry buffer",
+                   command_queue.enqueue_read_buffer(tb, 0 /* Offset */,
+                                                     sizeof(current),
+                                                     &current));
+      telemetry::print(std::clog, current, previous,
+                       benchmark::seconds(last, now), "cycles");
+      // The application never ends, so report the profiling as it goes
+      ocl::profiler::instance().report();
+      previous = current;
+      last = now;
+    }
   }
 }
@@ -0,0 +1,120 @@
+/** The MAC table of the multi-port L2 switch, shared by the host and
+    the device
+
+    Instead of the forward-or-drop set of the eth0 to eth1 router, the
+    switch maps each known Ethernet address to the bitmask of the ports
+    where to send it. The packets to a multicast or unknown address are
+    flooded to all the ports, and the table learns the port behind each
+    source address.
+
+    The packets are spread over several parallel router lanes by a hash
+    of their flow, so the packets of a flow stay in order on 1 lane
+    while the lanes never synchronize with each other.
+*/
+
+#ifndef SIMPLE_NETWORK_SWITCH_TABLE_HPP
+#define SIMPLE_NETWORK_SWITCH_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <xilinx/networking>
+#include <xilinx/util>
+
+namespace switching {
+
+using address = xlnx::network::ethernet::address;
+
+/// A set of ports, 1 bit per port
+using port_mask = std::uint32_t;
+
+/// The maximum number of ports of a switch
+constexpr unsigned max_ports = 8*sizeof(port_mask);
+
+/// The mask of the first n ports
+constexpr port_mask all_ports(unsigned n) {
+  return n >= max_ports ? ~port_mask { 0 } : (port_mask { 1 } << n) - 1;
+}
+
+/* The egress ports of each known address, with a lookup in constant
+   time for every packet */
+using table = xlnx::util::map<address, port_mask, 4096>;
+
+
+/// Is an address multicast or broadcast, with the I/G bit of its first byte
+inline bool multicast(address a) {
+  return a >> 40 & 1;
+}
+
+
+/** The ports where to send a packet
+
+    The known unicast addresses go to their ports and the other ones
+    are flooded, but never back to the port they come from.
+*/
+inline port_mask egress(const table &t, address dest, unsigned in_port,
+                        unsigned ports) {
+  auto flood = all_ports(ports);
+  auto out = multicast(dest) ? flood : t.lookup(dest, flood);
+  return out & ~(port_mask { 1 } << in_port);
+}
+
+
+/** Has a source address to be learned or moved to a new port?
+
+    The multicast addresses are never valid source addresses.
+*/
+inline bool unknown_source(const table &t, address src, unsigned in_port) {
+  return !multicast(src)
+    && t.lookup(src) != port_mask { 1 } << in_port;
+}
+
+
+/** The router lane of a flow, identified by its 2 addresses
+
+    This keeps the top bits of the hash and reduces them to [0, lanes)
+    with a multiplication instead of a division.
+*/
+inline unsigned flow_lane(address src, address dest, unsigned lanes) {
+  auto h = xlnx::util::hash<address> {}(src ^ (dest << 1)) >> 32;
+  return h*lanes >> 32;
+}
+
+
+/** A change in the table: the new ports of an address, or its removal
+    with no port at all
+
+    This is also what a router lane sends to learn a source address.
+*/
+struct delta {
+  address mac;
+  port_mask ports;
+};
+
+
+/// Apply a change to a table
+inline void apply(table &t, const delta &d) {
+  if (d.ports)
+    t.insert_or_assign(d.mac, d.ports);
+  else
+    t.erase(d.mac);
+}
+
+
+/// The maximum number of changes applied at once
+constexpr std::uint32_t max_batch = 64;
+
+/// Some changes applied together to a copy of the table
+struct batch {
+  std::uint32_t count = 0;
+  delta deltas[max_batch];
+
+  void apply_to(table &t) const {
+    for (std::uint32_t i = 0; i < count; ++i)
+      switching::apply(t, deltas[i]);
+  }
+};
+
+}
+
+#endif
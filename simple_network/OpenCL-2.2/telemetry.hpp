@@ -0,0 +1,78 @@
+/** The telemetry of the simple_network pipeline, shared by the host
+    and the device
+
+    Each stage counts its packets, its drops and the iterations it
+    spends waiting on a full or an empty pipe, and the sender records
+    the latency of the packets from the receiver in power-of-2 buckets.
+    On the device the block lives in program-scope global memory, each
+    counter being written by only 1 kernel, and the host reads a copy of
+    it from time to time with the read_telemetry kernel. The host
+    emulation in ../emulation fills the same block.
+*/
+
+#ifndef SIMPLE_NETWORK_TELEMETRY_HPP
+#define SIMPLE_NETWORK_TELEMETRY_HPP
+
+#include <cstdint>
+
+namespace telemetry {
+
+/// The stages of the pipeline with their own counters
+enum stage : unsigned { receiver, router, sender, stages };
+
+/// The counters of each stage
+enum counter : unsigned {
+  // Packets taken from the previous stage
+  in,
+  // Packets given to the next stage
+  out,
+  // Packets dropped by the stage, such as the ones filtered by the router
+  dropped,
+  // Iterations waiting for some room in the next pipe
+  full_stalls,
+  // Iterations finding the previous pipe empty
+  empty_polls,
+  counters
+};
+
+/// The latencies are in [2^k, 2^(k+1)) for bucket k
+constexpr unsigned latency_buckets = 48;
+
+/// The latency bucket of a duration
+inline unsigned latency_bucket(std::uint64_t t) {
+  unsigned k = 0;
+  while (t >>= 1)
+    ++k;
+  return k < latency_buckets ? k : latency_buckets - 1;
+}
+
+
+/** The telemetry block
+
+    \param Counter is the type of the counters, a plain integer on the
+    device
+*/
+template <typename Counter>
+struct basic_block {
+  Counter stage_counters[stages][counters];
+  /* The times the router switched to a new forwarding table, which is
+     the only synchronization left with the table updates since the
+     router does not take a lock */
+  Counter table_switches;
+  // The times eth0_receiver has been woken up by an interrupt
+  Counter wakeups;
+  // The latencies from eth0_receiver to eth1_sender
+  Counter latency[latency_buckets];
+
+  Counter &operator()(stage s, counter c) { return stage_counters[s][c]; }
+
+  const Counter &operator()(stage s, counter c) const {
+    return stage_counters[s][c];
+  }
+};
+
+using block = basic_block<std::uint64_t>;
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+/** Host-side display of the telemetry block of telemetry.hpp
+*/
+
+#ifndef SIMPLE_NETWORK_TELEMETRY_REPORT_HPP
+#define SIMPLE_NETWORK_TELEMETRY_REPORT_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "telemetry.hpp"
+
+namespace telemetry {
+
+/// Take a copy of a block with any type of counters
+template <typename Counter>
+block snapshot(const basic_block<Counter> &b) {
+  block s;
+  for (unsigned st = 0; st < stages; ++st)
+    for (unsigned c = 0; c < counters; ++c)
+      s.stage_counters[st][c] = b.stage_counters[st][c];
+  s.table_switches = b.table_switches;
+  s.wakeups = b.wakeups;
+  for (unsigned k = 0; k < latency_buckets; ++k)
+    s.latency[k] = b.latency[k];
+  return s;
+}
+
+
+/// The upper bound of the latency bucket holding some percentile
+inline std::uint64_t percentile(const std::uint64_t (&latency)[latency_buckets],
+                                double p) {
+  std::uint64_t n = 0;
+  for (auto l : latency)
+    n += l;
+  std::uint64_t seen = 0;
+  for (unsigned k = 0; k < latency_buckets; ++k) {
+    seen += latency[k];
+    if (seen && seen >= p/100*n)
+      return (std::uint64_t { 2 } << k) - 1;
+  }
+  return 0;
+}
+
+
+/** Display what happened between 2 snapshots
+
+    \param[in] seconds is the time between the snapshots
+
+    \param[in] unit is the unit of the latencies, cycles on the device
+*/
+inline void print(std::ostream &os, const block &now, const block &before,
+                  double seconds, const std::string &unit) {
+  static const char *names[stages] = { "receiver", "router", "sender" };
+  for (auto s : { receiver, router, sender }) {
+    auto delta = [&] (counter c) { return now(s, c) - before(s, c); };
+    os << names[s] << ": " << delta(in)/seconds << " in/s, "
+       << delta(out)/seconds << " out/s, " << delta(dropped)
+       << " dropped, " << delta(full_stalls) << " full stalls, "
+       << delta(empty_polls) << " empty polls" << std::endl;
+  }
+  std::uint64_t latency[latency_buckets];
+  for (unsigned k = 0; k < latency_buckets; ++k)
+    latency[k] = now.latency[k] - before.latency[k];
+  os << now.table_switches - before.table_switches << " table switches, "
+     << now.wakeups - before.wakeups << " receiver wake-ups, latency p50 < "
+     << percentile(latency, 50) << ' ' << unit << ", p99 < "
+     << percentile(latency, 99) << ' ' << unit << std::endl;
+}
+
+}
+
+#endif
@@ -0,0 +1,456 @@
+/** Host emulation of the multi-port L2 switch
+
+    This runs the kernel graph of ../OpenCL-2.2/l2_switch.cl on a plain
+    Linux machine:
+
+      port receivers -> router lanes -> per-port egress queues
+        -> port senders
+
+    with a learner thread updating the MAC table from the source
+    addresses seen by the lanes. Each kernel instance is a thread and
+    each pipe is a single-producer single-consumer queue.
+
+    The traffic comes from some hosts behind each port, talking to each
+    other, with some broadcasts and some packets to unknown addresses.
+    The table starts empty, so the first packets are flooded up to the
+    learning of their destination.
+
+    It reports the packets/s, the flooded packets, the learned
+    addresses, the load of each lane and the end-to-end latency. With
+    several numbers of lanes, it ends with a CSV summary of the
+    throughput against the number of lanes.
+
+    Usage: l2_switch_emulation [options]
+      --packets=N      number of packets (default 1Mi)
+      --ports=P        number of ports, up to 32 (default 4)
+      --lanes=N,M...   numbers of router lanes to try (default 1,2,4)
+      --hosts=H        number of hosts behind the ports (default 256)
+      --broadcast=R    fraction of broadcast packets (default 0.01)
+      --unknown=R      fraction of packets to unknown addresses
+                       (default 0.01)
+      --burst=B        burst size, up to 64 (default 8)
+      --depth=D        depth of the pipes in bursts (default 2)
+      --histograms     display the histogram buckets
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "latency_histogram.hpp"
+#include "spsc_queue.hpp"
+#include "switch_table.hpp"
+#include "traffic.hpp"
+
+/// The current time in ns
+inline std::uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+    (benchmark::clock::now().time_since_epoch()).count();
+}
+
+
+/// The emulation parameters
+struct parameters {
+  std::size_t packets = 1 << 20;
+  unsigned ports = 4;
+  std::vector<unsigned> lanes;
+  std::size_t hosts = 256;
+  double broadcast = 0.01;
+  double unknown = 0.01;
+  std::size_t burst = 8;
+  std::size_t depth = 2;
+  bool histograms = false;
+
+  parameters(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto option = benchmark::split_option(arg);
+      auto &key = option.first;
+      auto &value = option.second;
+      if (key == "--packets")
+        packets = benchmark::parse_size(value);
+      else if (key == "--ports")
+        ports = std::min<std::size_t>(switching::max_ports,
+                                      std::max<std::size_t>
+                                      (2, benchmark::parse_size(value)));
+      else if (key == "--lanes")
+        for (auto l : benchmark::split(value))
+          lanes.push_back(std::max(1UL, std::stoul(l)));
+      else if (key == "--hosts")
+        hosts = std::max<std::size_t>(2, benchmark::parse_size(value));
+      else if (key == "--broadcast")
+        broadcast = std::stod(value);
+      else if (key == "--unknown")
+        unknown = std::stod(value);
+      else if (key == "--burst")
+        burst = std::min(max_burst,
+                         std::max<std::size_t>(1, benchmark::parse_size(value)));
+      else if (key == "--depth")
+        depth = std::max<std::size_t>(1, benchmark::parse_size(value));
+      else if (key == "--histograms")
+        histograms = true;
+      else
+        throw std::invalid_argument { "Unknown option " + arg };
+    }
+    if (lanes.empty())
+      lanes = { 1, 2, 4 };
+  }
+};
+
+
+/// The outcome of an emulation
+struct summary {
+  double packets_per_second;
+  std::uint64_t p50;
+  std::uint64_t p99;
+};
+
+
+/// Some packets of 1 ingress port moving together
+struct port_burst : burst {
+  unsigned port;
+};
+
+
+/** Generate the traffic entering each port
+
+    Host h has the address 02:00:00:00:00:00 + h and is behind port
+    h % ports. Each packet goes from a random host to another one, or
+    to the broadcast address, or to an address unknown to the switch.
+*/
+std::vector<std::vector<packet>> traffic(const parameters &p) {
+  std::mt19937_64 generator { 42 };
+  std::uniform_real_distribution<> coin;
+  std::uniform_int_distribution<std::size_t> pick { 0, p.hosts - 1 };
+  std::uniform_int_distribution<std::uint32_t> length { 64, 1518 };
+  auto host = [] (std::size_t h) { return 0x020000000000ULL + h; };
+  std::vector<std::vector<packet>> ports(p.ports);
+  for (std::size_t i = 0; i < p.packets; ++i) {
+    packet pk {};
+    auto src = pick(generator);
+    pk.src = host(src);
+    auto c = coin(generator);
+    if (c < p.broadcast)
+      pk.dest = 0xffffffffffffULL;
+    else if (c < p.broadcast + p.unknown)
+      // Outside of the host range and unicast
+      pk.dest = host(p.hosts + (generator() & 0xffffff));
+    else {
+      auto dest = pick(generator);
+      pk.dest = host(dest == src ? (dest + 1) % p.hosts : dest);
+    }
+    pk.length = length(generator);
+    ports[src % p.ports].push_back(pk);
+  }
+  return ports;
+}
+
+
+/** The kernel graph, with the same names as in l2_switch.cl
+
+    The never-ending kernels stop when stop is set, at the end of the
+    emulation.
+*/
+class l2_switch {
+  const parameters &p;
+  const unsigned lanes;
+  const std::vector<std::vector<packet>> &traffic;
+  const std::size_t packets;
+
+  std::atomic<bool> stop { false };
+
+  /* 2 copies of the MAC table, the lanes reading the one of the last
+     published version while the learner updates the other one */
+  std::unique_ptr<switching::table[]> mac_table {
+    new switching::table[2] };
+  std::atomic<unsigned> table_version { 0 };
+
+  // What each lane owns, in its own cache line
+  struct alignas(cache_line) lane_state {
+    // The version of the table used by the lane
+    std::atomic<unsigned> version { 0 };
+    // The packets switched by the lane and sent to the egress queues
+    std::atomic<std::uint64_t> switched { 0 };
+    std::atomic<std::uint64_t> copies { 0 };
+    std::uint64_t flooded = 0;
+    std::uint64_t learn_dropped = 0;
+  };
+  std::vector<lane_state> lane;
+
+  // The packets sent by each port, with the latency histograms
+  struct alignas(cache_line) port_state {
+    std::atomic<std::uint64_t> sent { 0 };
+    latency_histogram latency;
+  };
+  std::vector<port_state> port;
+
+  // The pipes, indexed by [port][lane] and [lane][port]
+  std::vector<std::unique_ptr<spsc_queue<port_burst>>> lane_channel;
+  std::vector<std::unique_ptr<spsc_queue<port_burst>>> egress_channel;
+  std::vector<std::unique_ptr<spsc_queue<switching::delta>>> learn_channel;
+
+  // The number of versions published by the learner
+  std::uint64_t publications = 0;
+
+  spsc_queue<port_burst> &lane_pipe(unsigned port, unsigned l) {
+    return *lane_channel[port*lanes + l];
+  }
+
+  spsc_queue<port_burst> &egress_pipe(unsigned l, unsigned port) {
+    return *egress_channel[l*p.ports + port];
+  }
+
+  /** Spin up to a successful operation, yielding regularly to behave
+      on a machine with fewer cores than kernels
+
+      \return false if the emulation is stopped
+  */
+  template <typename Operation>
+  bool spin(Operation op) {
+    for (unsigned tries = 1; !op(); ++tries) {
+      if (stop.load(std::memory_order_relaxed))
+        return false;
+      if (tries % 64 == 0)
+        std::this_thread::yield();
+    }
+    return true;
+  }
+
+  template <typename T>
+  bool blocking_write(spsc_queue<T> &pipe, const T &value) {
+    return spin([&] { return pipe.try_push(value); });
+  }
+
+public:
+
+  l2_switch(const parameters &p,
+            unsigned lanes,
+            const std::vector<std::vector<packet>> &traffic)
+    : p { p }
+    , lanes { lanes }
+    , traffic { traffic }
+    , packets { p.packets }
+    , lane(lanes)
+    , port(p.ports) {
+    for (unsigned i = 0; i < p.ports*lanes; ++i) {
+      lane_channel.emplace_back(new spsc_queue<port_burst> { p.depth });
+      egress_channel.emplace_back(new spsc_queue<port_burst> { p.depth });
+    }
+    for (unsigned l = 0; l < lanes; ++l)
+      learn_channel.emplace_back
+        (new spsc_queue<switching::delta> { switching::max_batch });
+  }
+
+  /** Receive the packets of a port, as its Ethernet controller and its
+      receiver, and spread them over the lanes by flow */
+  void receiver(unsigned in) {
+    std::vector<port_burst> out(lanes);
+    for (auto &b : out)
+      b.port = in;
+    auto flush = [&] (unsigned l) {
+      auto ok = blocking_write(lane_pipe(in, l), out[l]);
+      out[l].count = 0;
+      return ok;
+    };
+    auto &packets = traffic[in];
+    for (std::size_t i = 0; i < packets.size();) {
+      // Take a burst from the wire
+      for (auto end = std::min(packets.size(), i + p.burst); i < end; ++i) {
+        auto pk = packets[i];
+        pk.timestamps[wire_in] = now();
+        auto l = switching::flow_lane(pk.src, pk.dest, lanes);
+        auto &b = out[l];
+        b.packets[b.count++] = pk;
+        if (b.count == p.burst && !flush(l))
+          return;
+      }
+      // Do not keep the packets waiting for a full burst
+      for (unsigned l = 0; l < lanes; ++l)
+        if (out[l].count && !flush(l))
+          return;
+    }
+  }
+
+  /// A router lane, switching the packets of its flows
+  void L2_switch_lane(unsigned l) {
+    auto &self = lane[l];
+    unsigned version = 0;
+    std::vector<port_burst> out(p.ports);
+    port_burst in;
+    for (unsigned tries = 1; !stop.load(std::memory_order_relaxed);
+         ++tries) {
+      /* Follow the published table, even when idle since the learner
+         waits for all the lanes before reusing a copy */
+      if (table_version.load(std::memory_order_relaxed) != version) {
+        version = table_version.load(std::memory_order_acquire);
+        self.version.store(version, std::memory_order_release);
+      }
+      // Serve the receivers in turn
+      if (!lane_pipe(tries % p.ports, l).try_pop(in)) {
+        if (tries % 64 == 0)
+          std::this_thread::yield();
+        continue;
+      }
+      auto &t = mac_table[version % 2];
+      std::uint64_t copies = 0;
+      for (std::size_t i = 0; i < in.count; ++i) {
+        auto &pk = in.packets[i];
+        if (switching::unknown_source(t, pk.src, in.port)
+            && !learn_channel[l]->try_push
+                 ({ pk.src, switching::port_mask { 1 } << in.port }))
+          // Just a hint, sent again by the next packet of the host
+          ++self.learn_dropped;
+        auto mask = switching::egress(t, pk.dest, in.port, p.ports);
+        // Even with only 2 ports, where a flood has a single egress port
+        self.flooded += switching::multicast(pk.dest) || !t.count(pk.dest);
+        for (unsigned e = 0; e < p.ports; ++e)
+          if (mask >> e & 1) {
+            ++copies;
+            out[e].packets[out[e].count++] = pk;
+            if (out[e].count == p.burst) {
+              if (!blocking_write(egress_pipe(l, e), out[e]))
+                return;
+              out[e].count = 0;
+            }
+          }
+      }
+      for (unsigned e = 0; e < p.ports; ++e)
+        if (out[e].count) {
+          if (!blocking_write(egress_pipe(l, e), out[e]))
+            return;
+          out[e].count = 0;
+        }
+      // Count the copies before the packets to know when all are sent
+      self.copies.fetch_add(copies, std::memory_order_relaxed);
+      self.switched.fetch_add(in.count, std::memory_order_release);
+    }
+  }
+
+  /** Send the packets switched to a port by all the lanes, as the
+      sender and the Ethernet controller of the port */
+  void sender(unsigned out) {
+    auto &self = port[out];
+    port_burst b;
+    for (unsigned tries = 1; !stop.load(std::memory_order_relaxed);
+         ++tries)
+      if (egress_pipe(tries % lanes, out).try_pop(b)) {
+        for (std::size_t i = 0; i < b.count; ++i)
+          self.latency.record(now() - b.packets[i].timestamps[wire_in]);
+        self.sent.fetch_add(b.count, std::memory_order_relaxed);
+      }
+      else if (tries % 64 == 0)
+        std::this_thread::yield();
+  }
+
+  /** The only writer of the MAC table
+
+      Gather the addresses learned by the lanes, apply them and the
+      previous batch to the copy no lane reads anymore, and publish it.
+  */
+  void learner() {
+    switching::batch previous, current;
+    for (unsigned l = 0; !stop.load(std::memory_order_relaxed);
+         l = (l + 1) % lanes) {
+      while (current.count < switching::max_batch
+             && learn_channel[l]->try_pop(current.deltas[current.count]))
+        ++current.count;
+      if (l != lanes - 1)
+        continue;
+      if (!current.count) {
+        std::this_thread::yield();
+        continue;
+      }
+      auto version = table_version.load(std::memory_order_relaxed);
+      for (auto &s : lane)
+        if (!spin([&] {
+              return s.version.load(std::memory_order_acquire) == version;
+            }))
+          return;
+      auto &t = mac_table[(version + 1) % 2];
+      previous.apply_to(t);
+      current.apply_to(t);
+      table_version.store(version + 1, std::memory_order_release);
+      ++publications;
+      previous = current;
+      current.count = 0;
+    }
+  }
+
+  /// Run the whole graph on the traffic and report the statistics
+  summary run() {
+    auto start = benchmark::clock::now();
+    std::vector<std::thread> kernels;
+    for (unsigned i = 0; i < p.ports; ++i) {
+      kernels.emplace_back(&l2_switch::receiver, this, i);
+      kernels.emplace_back(&l2_switch::sender, this, i);
+    }
+    for (unsigned l = 0; l < lanes; ++l)
+      kernels.emplace_back(&l2_switch::L2_switch_lane, this, l);
+    kernels.emplace_back(&l2_switch::learner, this);
+    // Wait for all the packets and their copies to be sent
+    for (;;) {
+      std::uint64_t switched = 0, copies = 0, sent = 0;
+      for (auto &s : lane) {
+        switched += s.switched.load(std::memory_order_acquire);
+        copies += s.copies.load(std::memory_order_relaxed);
+      }
+      for (auto &s : port)
+        sent += s.sent.load(std::memory_order_relaxed);
+      if (switched == packets && sent == copies)
+        break;
+      std::this_thread::yield();
+    }
+    auto time = benchmark::seconds(start, benchmark::clock::now());
+    stop = true;
+    for (auto &k : kernels)
+      k.join();
+
+    latency_histogram latency;
+    std::uint64_t sent = 0, flooded = 0, learn_dropped = 0;
+    for (auto &s : port) {
+      latency.merge(s.latency);
+      sent += s.sent;
+    }
+    std::cout << lanes << " lanes: " << packets << " packets in " << time
+              << " s: " << packets/time << " packets/s switched, "
+              << sent/time << " packets/s sent on " << p.ports
+              << " ports" << std::endl;
+    std::cout << "  per lane:";
+    for (auto &s : lane) {
+      std::cout << ' ' << s.switched;
+      flooded += s.flooded;
+      learn_dropped += s.learn_dropped;
+    }
+    std::cout << std::endl << "  " << flooded << " flooded, "
+              << mac_table[table_version % 2].size()
+              << " addresses learned in " << publications
+              << " table versions, " << learn_dropped
+              << " learning hints dropped" << std::endl;
+    latency.print(std::cout, "  End to end", p.histograms);
+    return { packets/time, latency.percentile(50), latency.percentile(99) };
+  }
+};
+
+
+int main(int argc, char *argv[]) {
+  parameters p { argc, argv };
+  auto ports = traffic(p);
+  std::vector<summary> summaries;
+  for (auto l : p.lanes)
+    summaries.push_back(l2_switch { p, l, ports }.run());
+  if (p.lanes.size() > 1) {
+    std::cout << std::endl << "lanes,packets_per_s,p50_ns,p99_ns"
+              << std::endl;
+    for (std::size_t i = 0; i < p.lanes.size(); ++i)
+      std::cout << p.lanes[i] << ',' << summaries[i].packets_per_second
+                << ',' << summaries[i].p50 << ',' << summaries[i].p99
+                << std::endl;
+  }
+}
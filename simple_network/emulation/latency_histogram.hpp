@@ -0,0 +1,79 @@
+/** A latency histogram with power-of-2 buckets
+
+    Recording is just an increment, so each pipeline stage can keep its
+    own histogram without any synchronization.
+*/
+
+#ifndef SIMPLE_NETWORK_EMULATION_LATENCY_HISTOGRAM_HPP
+#define SIMPLE_NETWORK_EMULATION_LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+class latency_histogram {
+  // Bucket k counts the latencies in [2^k, 2^(k+1)) ns, with 0 in bucket 0
+  std::array<std::uint64_t, 64> buckets {};
+  std::uint64_t n = 0;
+  std::uint64_t sum = 0;
+  std::uint64_t max = 0;
+
+  static unsigned bucket(std::uint64_t ns) {
+    unsigned k = 0;
+    while (ns >>= 1)
+      ++k;
+    return k;
+  }
+
+public:
+
+  /// Record a latency in nanoseconds
+  void record(std::uint64_t ns) {
+    ++buckets[bucket(ns)];
+    ++n;
+    sum += ns;
+    max = std::max(max, ns);
+  }
+
+  /// Add the content of another histogram
+  void merge(const latency_histogram &other) {
+    for (std::size_t k = 0; k < buckets.size(); ++k)
+      buckets[k] += other.buckets[k];
+    n += other.n;
+    sum += other.sum;
+    max = std::max(max, other.max);
+  }
+
+  std::uint64_t count() const { return n; }
+
+  double mean() const { return n ? double(sum)/n : 0; }
+
+  /** The upper bound of the bucket holding some percentile, so it is
+      accurate within a factor of 2 */
+  std::uint64_t percentile(double p) const {
+    std::uint64_t seen = 0;
+    for (std::size_t k = 0; k < buckets.size(); ++k) {
+      seen += buckets[k];
+      if (seen && seen >= p/100*n)
+        return std::min(max, (std::uint64_t { 2 } << k) - 1);
+    }
+    return max;
+  }
+
+  /// Display a summary line and optionally the non-empty buckets
+  void print(std::ostream &os, const std::string &name,
+             bool detailed = true) const {
+    os << name << ": " << n << " packets, mean " << mean()
+       << " ns, p50 < " << percentile(50) << " ns, p99 < "
+       << percentile(99) << " ns, max " << max << " ns" << std::endl;
+    for (std::size_t k = 0; detailed && k < buckets.size(); ++k)
+      if (buckets[k])
+        os << "  [" << (k ? std::uint64_t { 1 } << k : 0) << ", "
+           << (std::uint64_t { 2 } << k) << ") ns: " << buckets[k]
+           << std::endl;
+  }
+};
+
+#endif
@@ -0,0 +1,555 @@
+/** Host emulation of the simple_network kernel graph
+
+    This runs the pipeline of ../OpenCL-2.2/simple_network.cl on a
+    plain Linux machine:
+
+      eth0 controller -> eth0_receiver -> L2_router -> eth1_sender
+        -> eth1 controller
+
+    with the interrupts going through the interrupt controller and
+    dispatch_interrupt. Each kernel is a thread and each
+    cl::pipe_storage is a bounded lock-free single-producer
+    single-consumer queue. The Ethernet controllers are emulated by a
+    traffic source replaying synthetic packets or a pcap capture, and by
+    a sink.
+
+    The receiver, the router and the sender work on bursts of packets,
+    as simple_network.cl does.
+
+    It reports the packets/s and the latency histogram of each stage, to
+    tune the burst size, the pipe depths and the table design before
+    using the hardware. With several burst sizes, it ends with a CSV
+    summary of the throughput against the burst size.
+
+    The kernels also fill the telemetry block of the device, which can
+    be displayed periodically as simple_network.cpp does, with the
+    latencies in ns instead of cycles.
+
+    Usage: simple_network_emulation [options]
+      --packets=N      number of synthetic packets (default 1Mi)
+      --pcap=FILE      replay the Ethernet packets of a pcap file instead
+      --table=K        number of forwarded addresses (default 500). With
+                       a pcap file, the first K destinations seen
+      --hit-ratio=R    fraction of the synthetic packets to be forwarded
+                       (default 0.9)
+      --burst=N,M...   burst sizes to try, up to 64 (default 8)
+      --depth=D        depth of the burst pipes (default 2), the pipes
+                       of the Ethernet controllers holding D bursts
+      --coalesce-packets=N  send 1 interrupt to eth0_receiver for N
+                       packets (default 1)
+      --coalesce-time=T  or when the oldest pending interrupt is T ns
+                       old (default 10000)
+      --napi=K         NAPI-style adaptive polling: after an interrupt,
+                       eth0_receiver polls its pipe with the interrupts
+                       masked, and goes back to the interrupts after K
+                       empty polls (default 0, always use interrupts)
+      --histograms     display the histogram buckets
+      --telemetry=MS   display the telemetry every MS ms on the error
+                       output
+      --drop           the eth0 controller drops the packets when its
+                       pipe is full, instead of waiting as a lossless
+                       link with flow control
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "forward_table.hpp"
+#include "latency_histogram.hpp"
+#include "spsc_queue.hpp"
+#include "telemetry_report.hpp"
+#include "traffic.hpp"
+
+/// The current time in ns
+inline std::uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+    (benchmark::clock::now().time_since_epoch()).count();
+}
+
+
+/** A counter written by only 1 thread and read by other ones meanwhile,
+    as the telemetry counters on the device */
+class relaxed_counter {
+  std::atomic<std::uint64_t> value { 0 };
+
+public:
+
+  relaxed_counter &operator+=(std::uint64_t n) {
+    // No read-modify-write needed with a single writer
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    return *this;
+  }
+
+  relaxed_counter &operator++() { return *this += 1; }
+
+  operator std::uint64_t() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+
+/// The emulation parameters
+struct parameters {
+  std::size_t packets = 1 << 20;
+  std::string pcap;
+  std::size_t table = 500;
+  double hit_ratio = 0.9;
+  std::vector<std::size_t> bursts;
+  std::size_t depth = 2;
+  bool drop = false;
+  std::size_t coalesce_packets = 1;
+  std::uint64_t coalesce_time = 10000;
+  std::size_t napi = 0;
+  bool histograms = false;
+  std::size_t telemetry = 0;
+
+  parameters(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto option = benchmark::split_option(arg);
+      auto &key = option.first;
+      auto &value = option.second;
+      if (key == "--packets")
+        packets = benchmark::parse_size(value);
+      else if (key == "--pcap")
+        pcap = value;
+      else if (key == "--table")
+        table = benchmark::parse_size(value);
+      else if (key == "--hit-ratio")
+        hit_ratio = std::stod(value);
+      else if (key == "--burst")
+        for (auto b : benchmark::split(value))
+          bursts.push_back(std::min(max_burst,
+                                    std::max<std::size_t>(1, std::stoul(b))));
+      else if (key == "--depth")
+        depth = std::max<std::size_t>(1, benchmark::parse_size(value));
+      else if (key == "--coalesce-packets")
+        coalesce_packets = std::max<std::size_t>
+          (1, benchmark::parse_size(value));
+      else if (key == "--coalesce-time")
+        coalesce_time = benchmark::parse_size(value);
+      else if (key == "--napi")
+        napi = benchmark::parse_size(value);
+      else if (key == "--histograms")
+        histograms = true;
+      else if (key == "--telemetry")
+        telemetry = benchmark::parse_size(value);
+      else if (key == "--drop")
+        drop = true;
+      else
+        throw std::invalid_argument { "Unknown option " + arg };
+    }
+    if (bursts.empty())
+      bursts.push_back(8);
+  }
+};
+
+
+/// The outcome of an emulation
+struct summary {
+  double packets_per_second;
+  std::uint64_t p50;
+  std::uint64_t p99;
+};
+
+
+/// The devices raising interrupts
+enum device { eth0, eth1, devices };
+
+struct interrupt_descriptor {
+  device source;
+};
+
+
+/** The kernel graph, with the same names as in simple_network.cl
+
+    The never-ending kernels stop when stop is set, at the end of the
+    emulation.
+*/
+class network {
+  const parameters &p;
+  // The maximum number of packets per burst
+  const std::size_t burst_size;
+  const std::vector<packet> &traffic;
+  forwarding::table forward;
+
+  std::atomic<bool> stop { false };
+
+  // The interrupts raised by each device and the ones already sent
+  std::atomic<std::uint64_t> raised[devices] {};
+  std::uint64_t delivered[devices] {};
+
+  spsc_queue<interrupt_descriptor> interrupt_channel { 1 };
+  spsc_queue<burst> eth0_packet_channel, eth1_packet_channel;
+  spsc_queue<packet> raw_eth0_packet, raw_eth1_packet;
+  spsc_queue<bool> trigger_eth0_reading { 1 }, trigger_eth1_writing { 1 };
+
+  /* The telemetry of the device, where the receiver stage includes
+     the drops of the eth0 controller and the router drops the
+     filtered packets */
+  telemetry::basic_block<relaxed_counter> stats;
+  relaxed_counter &nic_dropped = stats(telemetry::receiver,
+                                       telemetry::dropped);
+  relaxed_counter &filtered = stats(telemetry::router, telemetry::dropped);
+  // Packets transmitted on eth1
+  std::atomic<std::uint64_t> transmitted { 0 };
+
+  /* Set by eth0_receiver while it polls its pipe, to mask its
+     interrupts in the dispatcher */
+  std::atomic<bool> eth0_polling { false };
+
+  /* The latency histograms between consecutive stages, each one
+     written by only 1 thread, and the end-to-end latency */
+  latency_histogram latencies[stages];
+
+  /** Spin up to a successful pipe operation, yielding regularly to
+      behave on a machine with fewer cores than kernels
+
+      \param[out] stalls counts the failed tries if not null
+
+      \return false if the emulation is stopped
+  */
+  template <typename Operation>
+  bool spin(Operation op, relaxed_counter *stalls = nullptr) {
+    unsigned tries = 0;
+    while (!op()) {
+      if (stop.load(std::memory_order_relaxed))
+        return false;
+      if (++tries % 64 == 0)
+        std::this_thread::yield();
+    }
+    if (stalls)
+      *stalls += tries;
+    return true;
+  }
+
+  template <typename T>
+  bool blocking_read(spsc_queue<T> &pipe, T &value,
+                     relaxed_counter *stalls = nullptr) {
+    return spin([&] { return pipe.try_pop(value); }, stalls);
+  }
+
+  template <typename T>
+  bool blocking_write(spsc_queue<T> &pipe, const T &value,
+                      relaxed_counter *stalls = nullptr) {
+    return spin([&] { return pipe.try_push(value); }, stalls);
+  }
+
+  /// Record the time of a stage and the latency since the previous one
+  void timestamp(packet &pk, stage s) {
+    pk.timestamps[s] = now();
+    latencies[s].record(pk.timestamps[s] - pk.timestamps[s - 1]);
+  }
+
+  void raise(device d) {
+    raised[d].fetch_add(1, std::memory_order_release);
+  }
+
+public:
+
+  network(const parameters &p,
+          std::size_t burst_size,
+          const std::vector<packet> &traffic,
+          const std::vector<forwarding::address> &forwarded)
+    : p { p }
+    , burst_size { burst_size }
+    , traffic { traffic }
+    , eth0_packet_channel { p.depth }
+    , eth1_packet_channel { p.depth }
+    , raw_eth0_packet { p.depth*burst_size }
+    , raw_eth1_packet { p.depth*burst_size } {
+    for (auto a : forwarded)
+      forward.insert(a);
+  }
+
+  /// The eth0 controller, receiving the traffic
+  void eth0_controller() {
+    for (auto pk : traffic) {
+      pk.timestamps[wire_in] = now();
+      if (p.drop) {
+        if (!raw_eth0_packet.try_push(pk)) {
+          ++nic_dropped;
+          continue;
+        }
+      }
+      else if (!blocking_write(raw_eth0_packet, pk))
+        return;
+      raise(eth0);
+    }
+  }
+
+  /// The interrupt controller, turning the interrupts into descriptors
+  void interrupt_controller() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      bool idle = true;
+      for (auto d : { eth0, eth1 })
+        if (delivered[d] < raised[d].load(std::memory_order_acquire)) {
+          if (!blocking_write(interrupt_channel, { d }))
+            return;
+          ++delivered[d];
+          idle = false;
+        }
+      if (idle)
+        std::this_thread::yield();
+    }
+  }
+
+  /** Dispatch the interrupts to the receiver and the sender
+
+      As in simple_network.cl, the triggers are never sent with a
+      blocking write. When eth0_receiver is stuck behind a full pipe, a
+      blocking dispatcher would wait on its trigger while the eth1
+      interrupt which would free the pipeline waits behind in the
+      interrupt channel, a deadlock. So both the kernel and this
+      emulation count the pending triggers of each device and send them
+      when their pipe has some room.
+
+      The eth0 interrupts are coalesced: only 1 trigger is sent for
+      coalesce_packets interrupts or when the oldest one is
+      coalesce_time old. They are not sent at all while eth0_receiver is
+      polling, but they are kept so that a packet arrived at the end of
+      the polling is not forgotten.
+  */
+  void dispatch_interrupt() {
+    std::uint64_t pending[devices] {};
+    // The time of the oldest pending eth0 interrupt
+    std::uint64_t oldest = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      bool idle = true;
+      interrupt_descriptor i;
+      if (interrupt_channel.try_pop(i)) {
+        if (i.source == eth0 && !pending[eth0])
+          oldest = now();
+        ++pending[i.source];
+        idle = false;
+      }
+      if (pending[eth0] && !eth0_polling.load(std::memory_order_acquire)
+          && (pending[eth0] >= p.coalesce_packets
+              || now() - oldest >= p.coalesce_time)
+          && trigger_eth0_reading.try_push(true)) {
+        pending[eth0] = 0;
+        idle = false;
+      }
+      if (pending[eth1] && trigger_eth1_writing.try_push(true)) {
+        --pending[eth1];
+        idle = false;
+      }
+      if (idle)
+        std::this_thread::yield();
+    }
+  }
+
+  /** Read the bursts of ethernet packets from eth0 for the forwarder
+
+      On an interrupt, read the bursts up to an empty pipe. In NAPI mode,
+      keep polling the pipe with the interrupts masked up to p.napi
+      empty polls in a row, so that under load there is no interrupt
+      round trip at all.
+  */
+  void eth0_receiver() {
+    burst b;
+    for (;;) {
+      bool unused;
+      if (!blocking_read(trigger_eth0_reading, unused))
+        return;
+      ++stats.wakeups;
+      if (p.napi)
+        eth0_polling.store(true, std::memory_order_release);
+      for (std::size_t idle = 0; !stop.load(std::memory_order_relaxed);) {
+        b.count = 0;
+        while (b.count < burst_size
+               && raw_eth0_packet.try_pop(b.packets[b.count])) {
+          timestamp(b.packets[b.count], received);
+          ++b.count;
+        }
+        if (b.count) {
+          stats(telemetry::receiver, telemetry::in) += b.count;
+          if (!blocking_write(eth0_packet_channel, b,
+                              &stats(telemetry::receiver,
+                                     telemetry::full_stalls)))
+            return;
+          stats(telemetry::receiver, telemetry::out) += b.count;
+          idle = 0;
+        }
+        else {
+          ++stats(telemetry::receiver, telemetry::empty_polls);
+          if (++idle > p.napi)
+            break;
+        }
+      }
+      // Unmask the interrupts, the ones arrived meanwhile are pending
+      eth0_polling.store(false, std::memory_order_release);
+    }
+  }
+
+  /// A trivial L2 packet forwarder from eth0 to eth1, burst by burst
+  void L2_router() {
+    burst in, out;
+    for (;;) {
+      if (!blocking_read(eth0_packet_channel, in,
+                         &stats(telemetry::router, telemetry::empty_polls)))
+        return;
+      stats(telemetry::router, telemetry::in) += in.count;
+      out.count = 0;
+      for (std::size_t i = 0; i < in.count; ++i) {
+        auto &pk = in.packets[i];
+        timestamp(pk, routed);
+        if (forward.count(pk.dest))
+          out.packets[out.count++] = pk;
+      }
+      // Only 1 update of the shared counter per burst
+      filtered += in.count - out.count;
+      if (out.count
+          && !blocking_write(eth1_packet_channel, out,
+                             &stats(telemetry::router,
+                                    telemetry::full_stalls)))
+        return;
+      stats(telemetry::router, telemetry::out) += out.count;
+    }
+  }
+
+  /// Send the bursts of packets from the forwarder to eth1
+  void eth1_sender() {
+    burst b;
+    for (;;) {
+      if (!blocking_read(eth1_packet_channel, b,
+                         &stats(telemetry::sender, telemetry::empty_polls)))
+        return;
+      stats(telemetry::sender, telemetry::in) += b.count;
+      for (std::size_t i = 0; i < b.count; ++i) {
+        // Wait for a free slot in the transmit pipe
+        bool unused;
+        if (!blocking_read(trigger_eth1_writing, unused,
+                           &stats(telemetry::sender, telemetry::full_stalls)))
+          return;
+        auto &pk = b.packets[i];
+        timestamp(pk, sent);
+        ++stats.latency[telemetry::latency_bucket(pk.timestamps[sent]
+                                                  - pk.timestamps[received])];
+        /* Since we have been notified by interruption, we know the pipe
+           to Ethernet is ready, so no need to wait */
+        raw_eth1_packet.try_push(pk);
+      }
+      stats(telemetry::sender, telemetry::out) += b.count;
+    }
+  }
+
+  /// The eth1 controller, transmitting the packets
+  void eth1_controller() {
+    // The transmit pipe is initially free
+    for (std::size_t i = 0; i < raw_eth1_packet.depth(); ++i)
+      raise(eth1);
+    for (;;) {
+      packet pk;
+      if (!blocking_read(raw_eth1_packet, pk))
+        return;
+      timestamp(pk, wire_out);
+      latencies[wire_in].record(pk.timestamps[wire_out]
+                                - pk.timestamps[wire_in]);
+      ++transmitted;
+      // A slot is free again
+      raise(eth1);
+    }
+  }
+
+  /// Run the whole graph on the traffic and report the statistics
+  summary run() {
+    auto start = benchmark::clock::now();
+    std::vector<std::thread> kernels;
+    for (auto k : { &network::eth0_controller,
+                    &network::interrupt_controller,
+                    &network::dispatch_interrupt,
+                    &network::eth0_receiver,
+                    &network::L2_router,
+                    &network::eth1_sender,
+                    &network::eth1_controller })
+      kernels.emplace_back(k, this);
+    /* The last telemetry displayed, from zero since the kernels have
+       already started counting */
+    telemetry::block before {};
+    auto last = start;
+    auto display = [&] (benchmark::clock::time_point now) {
+      auto current = telemetry::snapshot(stats);
+      telemetry::print(std::clog, current, before,
+                       benchmark::seconds(last, now), "ns");
+      before = current;
+      last = now;
+    };
+    // Wait for all the packets to leave the pipeline
+    while (nic_dropped + filtered + transmitted < traffic.size()) {
+      auto now = benchmark::clock::now();
+      if (p.telemetry
+          && now - last >= std::chrono::milliseconds { p.telemetry })
+        display(now);
+      std::this_thread::yield();
+    }
+    auto end = benchmark::clock::now();
+    auto time = benchmark::seconds(start, end);
+    if (p.telemetry)
+      display(end);
+    stop = true;
+    for (auto &k : kernels)
+      k.join();
+
+    auto processed = traffic.size() - nic_dropped;
+    std::cout << "Burst of " << burst_size << ": "
+              << traffic.size() << " packets in " << time << " s: "
+              << processed/time << " packets/s routed, "
+              << transmitted/time << " packets/s transmitted, "
+              << filtered << " filtered, " << nic_dropped
+              << " dropped by eth0, " << stats.wakeups
+              << " interrupts to eth0_receiver" << std::endl;
+    auto h = p.histograms;
+    latencies[received].print(std::cout, "eth0 to eth0_receiver", h);
+    latencies[routed].print(std::cout, "eth0_receiver to L2_router", h);
+    latencies[sent].print(std::cout, "L2_router to eth1_sender", h);
+    latencies[wire_out].print(std::cout, "eth1_sender to eth1", h);
+    latencies[wire_in].print(std::cout, "End to end", h);
+    return { processed/time, latencies[wire_in].percentile(50),
+             latencies[wire_in].percentile(99) };
+  }
+};
+
+
+int main(int argc, char *argv[]) {
+  parameters p { argc, argv };
+
+  std::vector<packet> traffic;
+  std::vector<forwarding::address> forwarded;
+  if (p.pcap.empty()) {
+    for (std::size_t i = 0; i < p.table; ++i)
+      // Some locally administered unicast addresses
+      forwarded.push_back(0x020000000000ULL + i);
+    traffic = synthetic_traffic(p.packets, forwarded, p.hit_ratio);
+  }
+  else {
+    traffic = read_pcap(p.pcap);
+    std::unordered_set<forwarding::address> seen;
+    for (auto &pk : traffic)
+      if (forwarded.size() < p.table && seen.insert(pk.dest).second)
+        forwarded.push_back(pk.dest);
+  }
+  if (forwarded.size() > forwarding::table::max_size())
+    throw std::invalid_argument { "The forwarding table is limited to "
+        + std::to_string(forwarding::table::max_size()) + " addresses" };
+
+  std::vector<summary> summaries;
+  for (auto b : p.bursts)
+    summaries.push_back(network { p, b, traffic, forwarded }.run());
+  if (p.bursts.size() > 1) {
+    std::cout << std::endl << "burst,packets_per_s,p50_ns,p99_ns"
+              << std::endl;
+    for (std::size_t i = 0; i < p.bursts.size(); ++i)
+      std::cout << p.bursts[i] << ',' << summaries[i].packets_per_second
+                << ',' << summaries[i].p50 << ',' << summaries[i].p99
+                << std::endl;
+  }
+}
@@ -0,0 +1,74 @@
+/** A bounded lock-free single-producer single-consumer queue
+
+    This stands for a cl::pipe_storage between 2 kernels in the host
+    emulation: the writes and reads are non-blocking and fail when the
+    queue is full or empty, as the OpenCL pipe operations do.
+*/
+
+#ifndef SIMPLE_NETWORK_EMULATION_SPSC_QUEUE_HPP
+#define SIMPLE_NETWORK_EMULATION_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/// The usual cache line size, to avoid false sharing
+constexpr std::size_t cache_line = 64;
+
+template <typename T>
+class spsc_queue {
+  std::vector<T> slots;
+
+  // The number of elements ever written, only modified by the producer
+  alignas(cache_line) std::atomic<std::size_t> tail { 0 };
+  // The last head seen by the producer, to avoid reading it every time
+  std::size_t cached_head = 0;
+
+  // The number of elements ever read, only modified by the consumer
+  alignas(cache_line) std::atomic<std::size_t> head { 0 };
+  // The last tail seen by the consumer
+  std::size_t cached_tail = 0;
+
+public:
+
+  /// Create a queue holding up to depth elements, as a pipe depth
+  explicit spsc_queue(std::size_t depth) : slots(depth ? depth : 1) {}
+
+  spsc_queue(const spsc_queue &) = delete;
+
+  /// Try to write a value, from the producer
+  bool try_push(const T &value) {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t - cached_head == slots.size()) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (t - cached_head == slots.size())
+        return false;
+    }
+    slots[t % slots.size()] = value;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Try to read a value, from the consumer
+  bool try_pop(T &value) {
+    auto h = head.load(std::memory_order_relaxed);
+    if (h == cached_tail) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (h == cached_tail)
+        return false;
+    }
+    value = slots[h % slots.size()];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// The number of elements in the queue, only approximate
+  std::size_t size() const {
+    return tail.load(std::memory_order_relaxed)
+      - head.load(std::memory_order_relaxed);
+  }
+
+  std::size_t depth() const { return slots.size(); }
+};
+
+#endif
@@ -0,0 +1,150 @@
+/** The packets of the emulation and the traffic sources
+
+    Only the Ethernet header matters to the L2 pipeline, so a packet
+    carries its addresses and its length, plus the times it crossed each
+    stage for the latency measurements.
+*/
+
+#ifndef SIMPLE_NETWORK_EMULATION_TRAFFIC_HPP
+#define SIMPLE_NETWORK_EMULATION_TRAFFIC_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "forward_table.hpp"
+
+/// The stages of the pipeline where a packet gets a timestamp
+enum stage {
+  // Received by the eth0 controller
+  wire_in,
+  // Read by eth0_receiver
+  received,
+  // Forwarded by L2_router
+  routed,
+  // Written to eth1 by eth1_sender
+  sent,
+  // Transmitted by the eth1 controller
+  wire_out,
+  stages
+};
+
+
+struct packet {
+  forwarding::address dest;
+  forwarding::address src;
+  std::uint32_t length;
+  // The time in ns at each stage
+  std::uint64_t timestamps[stages];
+};
+
+
+/// The maximum number of packets in a burst
+constexpr std::size_t max_burst = 64;
+
+/** Some packets moving together between 2 stages, to pay the pipe
+    operations and the control once per burst instead of once per packet
+    as DPDK does */
+struct burst {
+  std::size_t count = 0;
+  packet packets[max_burst];
+
+  burst() = default;
+
+  burst(const burst &other) { *this = other; }
+
+  // Copy only the packets in use
+  burst &operator=(const burst &other) {
+    count = other.count;
+    std::copy_n(other.packets, count, packets);
+    return *this;
+  }
+};
+
+
+/// Read a 48-bit big-endian MAC address
+inline forwarding::address mac(const unsigned char *bytes) {
+  forwarding::address a = 0;
+  for (int i = 0; i < 6; ++i)
+    a = a << 8 | bytes[i];
+  return a;
+}
+
+
+/** Read the Ethernet packets of a pcap file
+
+    Both byte orders and both the microsecond and nanosecond variants
+    are understood. Only the link type Ethernet makes sense here.
+*/
+inline std::vector<packet> read_pcap(const std::string &file) {
+  std::ifstream f { file, std::ios::binary };
+  if (!f)
+    throw std::runtime_error { "Cannot open " + file };
+  unsigned char header[24];
+  if (!f.read(reinterpret_cast<char *>(header), sizeof(header)))
+    throw std::runtime_error { file + " is too short for a pcap file" };
+  // The magic number tells the byte order of the file
+  bool swapped;
+  auto magic = header[0] | header[1] << 8 | header[2] << 16
+    | std::uint32_t(header[3]) << 24;
+  if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+    swapped = false;
+  else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+    swapped = true;
+  else
+    throw std::runtime_error { file + " is not a pcap file" };
+  auto u32 = [&] (const unsigned char *b) {
+    return swapped
+      ? std::uint32_t(b[0]) << 24 | b[1] << 16 | b[2] << 8 | b[3]
+      : b[0] | b[1] << 8 | b[2] << 16 | std::uint32_t(b[3]) << 24;
+  };
+
+  std::vector<packet> packets;
+  unsigned char record[16];
+  std::vector<unsigned char> data;
+  while (f.read(reinterpret_cast<char *>(record), sizeof(record))) {
+    auto captured = u32(record + 8);
+    data.resize(captured);
+    if (!f.read(reinterpret_cast<char *>(data.data()), captured))
+      break;
+    // Skip the truncated frames without a full Ethernet header
+    if (captured < 14)
+      continue;
+    packet p {};
+    p.dest = mac(&data[0]);
+    p.src = mac(&data[6]);
+    p.length = u32(record + 12);
+    packets.push_back(p);
+  }
+  return packets;
+}
+
+
+/** Generate some traffic towards a set of known destinations
+
+    \param[in] hit_ratio is the fraction of the packets whose destination
+    is in the known set, the other ones having random destinations
+*/
+inline std::vector<packet>
+synthetic_traffic(std::size_t n,
+                  const std::vector<forwarding::address> &known,
+                  double hit_ratio) {
+  std::mt19937_64 generator { 42 };
+  std::uniform_real_distribution<> coin;
+  std::uniform_int_distribution<std::size_t> pick { 0, known.size() - 1 };
+  std::uniform_int_distribution<std::uint32_t> length { 64, 1518 };
+  std::vector<packet> packets(n);
+  for (auto &p : packets) {
+    p.dest = !known.empty() && coin(generator) < hit_ratio
+      ? known[pick(generator)] : generator() & 0xffffffffffffULL;
+    p.src = generator() & 0xffffffffffffULL;
+    p.length = length(generator);
+  }
+  return packets;
+}
+
+#endif
@@ -1,5 +1,27 @@
 /** Simple streaming example
 
+    The kernel can have 2 shapes:
+
+    - "single": 1 work-item looping over all the elements, which is the
+      natural pipelined form for an FPGA;
+
+    - "ndrange": a data-parallel kernel where each work-item processes
+      some vectors of elements, which is what CPU and GPU need to use all
+      their lanes and cores.
+
+    By default the shape is chosen from the device type, but it can be
+    forced and tuned with:
+      --kernel=single|ndrange
+      --vector=1|2|4|8|16  elements per vector, such as int4 (default:
+                           preferred vector width of the device)
+      --local=L            work-group size (default: chosen by the runtime)
+      --items=I            vectors per work-item (default 1)
+
+    The host vectors are in pinned memory, so that the transfers are
+    done without any intermediate copy, see opencl_pinned_memory.hpp.
+
+    Run with OPENCL_PROFILE=trace.json to see the transfer and kernel
+    times, see opencl_profiler.hpp.
  */
 
 #include <boost/compute.hpp>
@@ -8,8 +30,13 @@
 #include <cstddef>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "benchmark.hpp"
+#include "opencl_pinned_memory.hpp"
+#include "opencl_profiler.hpp"
+
 // 1 Mi elements
 #define N (2<<20)
 #define TYPE int
@@ -17,14 +44,62 @@
 #define K_TYPE BOOST_PP_STRINGIZE(TYPE)
 #define K_N BOOST_PP_STRINGIZE(N)
 
-int main() {
-  std::vector<TYPE> input(N);
-  std::vector<TYPE> output(N);
+/// The launch shape of the kernel
+struct shape {
+  bool single;
+  std::size_t vector;
+  std::size_t local = 0;
+  std::size_t items = 1;
+
+  /// Choose a default shape according to the device
+  shape(const boost::compute::device &d)
+    : single { (d.type() & CL_DEVICE_TYPE_ACCELERATOR) != 0 }
+    , vector { std::max<std::size_t>(1, d.preferred_vector_width<TYPE>()) }
+  {}
+
+  /// Override the default shape from the command line
+  void parse(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto option = benchmark::split_option(arg);
+      auto &key = option.first;
+      auto &value = option.second;
+      if (key == "--kernel" && (value == "single" || value == "ndrange"))
+        single = value == "single";
+      else if (key == "--vector")
+        vector = std::stoul(value);
+      else if (key == "--local")
+        local = std::stoul(value);
+      else if (key == "--items")
+        items = std::max<std::size_t>(1, std::stoul(value));
+      else
+        throw std::invalid_argument { "Unknown option " + arg };
+    }
+    if (vector != 1 && vector != 2 && vector != 4 && vector != 8
+        && vector != 16)
+      throw std::invalid_argument { "Unsupported vector width" };
+    if (N % vector)
+      throw std::invalid_argument { "N is not a multiple of the vector width" };
+  }
+};
 
+
+int main(int argc, char *argv[]) {
   // Create the OpenCL context to attach resources on the device
   auto context = boost::compute::system::default_context();
-  // Create the OpenCL command queue to control the device
-  auto command_queue = boost::compute::system::default_queue();
+  /* Create the OpenCL command queue to control the device, with
+     profiling if requested */
+  boost::compute::command_queue command_queue {
+    context, context.get_device(), ocl::profiler::instance().queue_flags()
+  };
+
+  // The host data in page-locked memory, for DMA transfers
+  ocl::pinned_pool pinned { context.get(), command_queue.get() };
+  std::vector<TYPE, ocl::pinned_allocator<TYPE>> input(N, pinned);
+  std::vector<TYPE, ocl::pinned_allocator<TYPE>> output(N, pinned);
+
+  shape s { command_queue.get_device() };
+  s.parse(argc, argv);
 
   // The input buffer for OpenCL
   boost::compute::buffer ib { context, N*sizeof(TYPE), CL_MEM_READ_ONLY };
@@ -34,39 +109,94 @@ int main() {
 
   // Construct an OpenCL program from the source string
   auto program = boost::compute::program::create_with_source(R"(
+    /* Single work-item version, pipelined by an FPGA compiler */
     __kernel void
     simple_stream(const __global )" K_TYPE R"( *ib,
                   __global )" K_TYPE R"( *ob) {
           for (int i = 0; i != )" K_N R"(; ++i)
             ob[i] = ib[i] + 1;
     }
+
+    #define CONCAT_(a, b) a##b
+    #define CONCAT(a, b) CONCAT_(a, b)
+    #if VECTOR == 1
+    #define LOAD(i, p) (p)[i]
+    #define STORE(v, i, p) ((p)[i] = (v))
+    #else
+    #define LOAD(i, p) CONCAT(vload, VECTOR)(i, p)
+    #define STORE(v, i, p) CONCAT(vstore, VECTOR)(v, i, p)
+    #endif
+
+    /* Data-parallel version where each work-item processes ITEMS
+       vectors of VECTOR elements.
+
+       The vectors of a work-item are strided by the global size so that
+       consecutive work-items access consecutive memory locations */
+    __kernel void
+    simple_stream_ndrange(const __global )" K_TYPE R"( *ib,
+                          __global )" K_TYPE R"( *ob) {
+          const size_t vectors = )" K_N R"( / VECTOR;
+          for (int j = 0; j != ITEMS; ++j) {
+            size_t v = get_global_id(0) + j*get_global_size(0);
+            if (v < vectors)
+              STORE(LOAD(v, ib) + 1, v, ob);
+          }
+    }
       )", boost::compute::system::default_context());
 
-  program.build();
+  program.build("-DVECTOR=" + std::to_string(s.vector)
+                + " -DITEMS=" + std::to_string(s.items));
 
-  auto kernel = boost::compute::kernel { program, "simple_stream" };
+  auto kernel = boost::compute::kernel {
+    program, s.single ? "simple_stream" : "simple_stream_ndrange"
+  };
 
   // Initalize host data with increasing numbers starting at 0
   std::iota(input.begin(), input.end(), 0);
 
   // Send the input data to the accelerator
-  command_queue.enqueue_write_buffer(ib, 0 /* Offset */,
-                                     N*sizeof(TYPE), input.data());
+  ocl::profile("write",
+               command_queue.enqueue_write_buffer(ib, 0 /* Offset */,
+                                                  N*sizeof(TYPE),
+                                                  input.data()));
 
   kernel.set_args(ib, ob);
 
   boost::compute::extents<1> offset { 0 };
-  // Use 1 work-group with 1 work-item
-  boost::compute::extents<1> global { 1 };
-  boost::compute::extents<1> local { 1 };
-  // Launch the kernel
-  command_queue.enqueue_nd_range_kernel(kernel, offset, global, local);
+  if (s.single) {
+    std::cout << "Single work-item kernel" << std::endl;
+    // Use 1 work-group with 1 work-item
+    boost::compute::extents<1> global { 1 };
+    boost::compute::extents<1> local { 1 };
+    // Launch the kernel
+    ocl::profile("simple_stream",
+                 command_queue.enqueue_nd_range_kernel(kernel, offset, global,
+                                                       local));
+  }
+  else {
+    // Enough work-items to cover all the vectors
+    auto work_items = (N/s.vector + s.items - 1)/s.items;
+    if (s.local)
+      // The global size has to be a multiple of the work-group size
+      work_items = (work_items + s.local - 1)/s.local*s.local;
+    std::cout << "NDRange kernel with " << work_items << " work-items of "
+              << s.items << " x " << K_TYPE << s.vector << " in work-groups of "
+              << (s.local ? std::to_string(s.local) : "runtime choice")
+              << std::endl;
+    // A local size of 0 lets the runtime choose
+    ocl::profile("simple_stream_ndrange",
+                 command_queue.enqueue_1d_range_kernel(kernel, 0, work_items,
+                                                       s.local));
+  }
 
   // Get the output data from the accelerator
-  command_queue.enqueue_read_buffer(ob, 0 /* Offset */,
-                                    N*sizeof(TYPE), output.data());
+  ocl::profile("read",
+               command_queue.enqueue_read_buffer(ob, 0 /* Offset */,
+                                                 N*sizeof(TYPE),
+                                                 output.data()));
 
   for (std::size_t i = 0; i != N; ++i)
     if (output[i] != input[i] + 1)
       throw std::runtime_error { "Wrong result" };
+  ocl::profiler::instance().report();
 }
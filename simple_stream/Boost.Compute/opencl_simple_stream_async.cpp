@@ -0,0 +1,152 @@
+/** Simple streaming example with overlapped transfers and computation
+
+    The input is split into chunks and each chunk goes through a 3-stage
+    pipeline: the write of chunk k+1 to the device, the kernel on chunk k
+    and the read back of chunk k-1 all run at the same time, so the
+    throughput approaches the one of the slowest stage instead of the sum
+    of the stages.
+
+    Each stage has its own in-order command queue and the dependencies
+    between the stages are only expressed with events. A ring of device
+    buffers is used to have several chunks in flight.
+
+    The host vectors are in pinned memory, so that the transfers can be
+    done by DMA and really overlap, see opencl_pinned_memory.hpp.
+
+    Usage: opencl_simple_stream_async [chunk_elements [buffer_depth]]
+
+    Run with OPENCL_PROFILE=trace.json to see the overlap of the 3
+    queues in a trace viewer, see opencl_profiler.hpp.
+ */
+
+#include <boost/compute.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "opencl_pinned_memory.hpp"
+#include "opencl_profiler.hpp"
+
+// 1 Mi elements
+#define N (2<<20)
+#define TYPE int
+// To inline constants in kernel source code string
+#define K_TYPE BOOST_PP_STRINGIZE(TYPE)
+
+int main(int argc, char *argv[]) {
+  // Number of elements per chunk
+  std::size_t chunk = argc > 1 ? std::stoul(argv[1]) : N/16;
+  chunk = std::max<std::size_t>(1, std::min<std::size_t>(chunk, N));
+  // Number of chunks in flight, 2 is enough for a write/compute/read pipeline
+  std::size_t depth = argc > 2 ? std::stoul(argv[2]) : 2;
+  depth = std::max<std::size_t>(1, depth);
+  const std::size_t chunks = (N + chunk - 1)/chunk;
+
+  // Create the OpenCL context to attach resources on the device
+  auto context = boost::compute::system::default_context();
+  auto device = boost::compute::system::default_device();
+  /* Use 1 in-order command queue per pipeline stage so that the 2
+     transfer directions and the computation can overlap */
+  auto profiling = ocl::profiler::instance().queue_flags();
+  boost::compute::command_queue write_queue { context, device, profiling };
+  boost::compute::command_queue compute_queue { context, device, profiling };
+  boost::compute::command_queue read_queue { context, device, profiling };
+
+  // The host data in page-locked memory, for DMA transfers
+  ocl::pinned_pool pinned { context.get(), write_queue.get() };
+  std::vector<TYPE, ocl::pinned_allocator<TYPE>> input(N, pinned);
+  std::vector<TYPE, ocl::pinned_allocator<TYPE>> output(N, pinned);
+
+  // The rings of input and output buffers for OpenCL
+  std::vector<boost::compute::buffer> ib, ob;
+  for (std::size_t i = 0; i != depth; ++i) {
+    ib.emplace_back(context, chunk*sizeof(TYPE), CL_MEM_READ_ONLY);
+    ob.emplace_back(context, chunk*sizeof(TYPE), CL_MEM_WRITE_ONLY);
+  }
+
+  /* Construct an OpenCL program from the source string
+
+     The chunk size is a kernel parameter since the last chunk may be
+     smaller */
+  auto program = boost::compute::program::create_with_source(R"(
+    __kernel void
+    simple_stream(const __global )" K_TYPE R"( *ib,
+                  __global )" K_TYPE R"( *ob,
+                  int n) {
+          for (int i = 0; i != n; ++i)
+            ob[i] = ib[i] + 1;
+    }
+      )", context);
+
+  program.build();
+
+  auto kernel = boost::compute::kernel { program, "simple_stream" };
+
+  // Initalize host data with increasing numbers starting at 0
+  std::iota(input.begin(), input.end(), 0);
+
+  // The completion events of each stage for each chunk
+  std::vector<boost::compute::event> written(chunks), computed(chunks),
+    read(chunks);
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t k = 0; k != chunks; ++k) {
+    auto slot = k % depth;
+    auto offset = k*chunk;
+    auto size = std::min<std::size_t>(chunk, N - offset);
+
+    // The input buffer can be overwritten once its previous kernel is done
+    boost::compute::wait_list before_write;
+    if (k >= depth)
+      before_write.insert(computed[k - depth]);
+    written[k] = write_queue.enqueue_write_buffer_async(ib[slot], 0,
+                                                        size*sizeof(TYPE),
+                                                        &input[offset],
+                                                        before_write);
+
+    /* The kernel needs its input and can overwrite the output buffer
+       once it has been read back */
+    boost::compute::wait_list before_kernel { written[k] };
+    if (k >= depth)
+      before_kernel.insert(read[k - depth]);
+    kernel.set_args(ib[slot], ob[slot], static_cast<cl_int>(size));
+    // Use 1 work-group with 1 work-item, as in opencl_simple_stream
+    computed[k] = compute_queue.enqueue_1d_range_kernel(kernel, 0, 1, 1,
+                                                        before_kernel);
+
+    // Get the output data from the accelerator
+    read[k] = read_queue.enqueue_read_buffer_async(ob[slot], 0,
+                                                   size*sizeof(TYPE),
+                                                   &output[offset],
+                                                   computed[k]);
+
+    // Keep the events for the profiling, if enabled
+    ocl::profile("write", written[k]);
+    ocl::profile("simple_stream", computed[k]);
+    ocl::profile("read", read[k]);
+
+    // Submit the commands now instead of when a queue is full
+    write_queue.flush();
+    compute_queue.flush();
+    read_queue.flush();
+  }
+  read_queue.finish();
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  for (std::size_t i = 0; i != N; ++i)
+    if (output[i] != input[i] + 1)
+      throw std::runtime_error { "Wrong result" };
+
+  std::cout << chunks << " chunks of " << chunk << " elements with "
+            << depth << " buffers in flight: " << elapsed.count() << " s, "
+            << 2.*N*sizeof(TYPE)/elapsed.count()*1e-9 << " GB/s"
+            << std::endl;
+  ocl::profiler::instance().report();
+}
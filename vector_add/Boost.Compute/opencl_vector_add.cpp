@@ -1,26 +1,55 @@
+/* Vector addition with Boost.Compute
+
+   Run with "zero_copy" as argument to have the buffers use the
+   page-aligned host arrays directly with CL_MEM_USE_HOST_PTR and map
+   the output back instead of copying the data, which avoids any copy
+   on CPU and integrated devices.
+
+   Run with OPENCL_PROFILE=trace.json to get a trace and a summary of
+   the OpenCL commands, see opencl_profiler.hpp.
+*/
+
 #include <boost/compute.hpp>
 #include <iostream>
 #include <iterator>
+#include <string>
+
+#include "opencl_profiler.hpp"
 
 constexpr size_t N = 3;
 using Vector = float[N];
 
-int main() {
-  Vector a = { 1, 2, 3 };
-  Vector b = { 5, 6, 8 };
-  Vector c;
+int main(int argc, char *argv[]) {
+  const bool zero_copy = argc > 1 && std::string { argv[1] } == "zero_copy";
+  /* Page-aligned host arrays, so that the implementation can use them
+     directly in zero-copy mode */
+  alignas(4096) Vector a = { 1, 2, 3 };
+  alignas(4096) Vector b = { 5, 6, 8 };
+  alignas(4096) Vector c;
 
   // Create the OpenCL context to attach resources on the device
   auto context = boost::compute::system::default_context();
-  // Create the OpenCL command queue to control the device
-  auto command_queue = boost::compute::system::default_queue();
+  /* Create the OpenCL command queue to control the device, with
+     profiling if requested */
+  boost::compute::command_queue command_queue {
+    context, context.get_device(), ocl::profiler::instance().queue_flags()
+  };
+
+  // Use the host memory as the buffer storage in zero-copy mode
+  const cl_mem_flags use_host = zero_copy ? CL_MEM_USE_HOST_PTR : 0;
 
   // The input buffers for OpenCL
-  boost::compute::buffer buffer_a { context, sizeof(a), CL_MEM_READ_ONLY };
-  boost::compute::buffer buffer_b { context, sizeof(b), CL_MEM_READ_ONLY };
+  boost::compute::buffer buffer_a { context, sizeof(a),
+                                    CL_MEM_READ_ONLY | use_host,
+                                    zero_copy ? a : nullptr };
+  boost::compute::buffer buffer_b { context, sizeof(b),
+                                    CL_MEM_READ_ONLY | use_host,
+                                    zero_copy ? b : nullptr };
 
   // The output buffer for OpenCL
-  boost::compute::buffer buffer_c { context, sizeof(c), CL_MEM_WRITE_ONLY };
+  boost::compute::buffer buffer_c { context, sizeof(c),
+                                    CL_MEM_WRITE_ONLY | use_host,
+                                    zero_copy ? c : nullptr };
 
   // Construct an OpenCL program from the source file
   auto program =
@@ -29,11 +58,15 @@ int main() {
 
   auto kernel = boost::compute::kernel { program, "vector_add" };
 
-  // Send the input data to the accelerator
-  command_queue.enqueue_write_buffer(buffer_a, 0 /* Offset */,
-                                      sizeof(a), &a[0]);
-  command_queue.enqueue_write_buffer(buffer_b, 0 /* Offset */,
-                                      sizeof(b), &b[0]);
+  if (!zero_copy) {
+    // Send the input data to the accelerator
+    ocl::profile("write a",
+                 command_queue.enqueue_write_buffer(buffer_a, 0 /* Offset */,
+                                                    sizeof(a), &a[0]));
+    ocl::profile("write b",
+                 command_queue.enqueue_write_buffer(buffer_b, 0 /* Offset */,
+                                                    sizeof(b), &b[0]));
+  }
 
   kernel.set_args(buffer_a, buffer_b, buffer_c);
 
@@ -42,14 +75,30 @@ int main() {
   // Use only 1 CU
   boost::compute::extents<1> local { N };
   // Launch the kernel
-  command_queue.enqueue_nd_range_kernel(kernel, offset, global, local);
+  ocl::profile("vector_add",
+               command_queue.enqueue_nd_range_kernel(kernel, offset, global,
+                                                     local));
 
-  // Get the output data from the accelerator
-  command_queue.enqueue_read_buffer(buffer_c, 0 /* Offset */,
-                                    sizeof(c), &c[0]);
+  if (zero_copy) {
+    /* Mapping makes the output coherent in c, which is a no-op on a
+       device sharing the memory with the host */
+    boost::compute::event mapped;
+    auto p = command_queue.enqueue_map_buffer(buffer_c, CL_MAP_READ,
+                                              0 /* Offset */, sizeof(c),
+                                              mapped);
+    ocl::profile("map c", mapped);
+    ocl::profile("unmap c",
+                 command_queue.enqueue_unmap_buffer(buffer_c, p)).wait();
+  }
+  else
+    // Get the output data from the accelerator
+    ocl::profile("read c",
+                 command_queue.enqueue_read_buffer(buffer_c, 0 /* Offset */,
+                                                   sizeof(c), &c[0]));
 
   std::cout << std::endl << "Result:" << std::endl;
   for(auto e : c)
     std::cout << e << " ";
   std::cout << std::endl;
+  ocl::profiler::instance().report();
 }
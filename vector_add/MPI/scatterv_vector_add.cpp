@@ -0,0 +1,422 @@
+/* Scalable vector addition with MPI collectives
+
+   Unlike parallel_vector_add.cpp, this works for any vector size and any
+   number of ranks: the root distributes contiguous blocks of a and b
+   with MPI_Scatterv, each rank adds its block locally and the root
+   collects c with MPI_Gatherv.
+
+   This is also a scaling benchmark using the options of benchmark.hpp,
+   for example on a single machine:
+     for k in 1 2 4 8; do
+       mpirun -np $k ./scatterv_vector_add --min=1Mi --max=64Mi
+     done
+   measures the strong scaling, since the sizes are the global sizes,
+   while adding --weak makes the sizes per rank to measure the weak
+   scaling.
+
+   Other options:
+     --device=host     vectorized loop on 1 core per rank (default)
+     --device=openmp   OpenMP parallel loop on the cores of each rank
+     --device=opencl   offload to an OpenCL device of the node, the ranks
+                       of a node being spread over its devices. Only
+                       available when compiled with WITH_OPENCL, see the
+                       Makefile
+
+     --pipeline=K      pipelined mode, see below
+
+   The transfer time is the scatter and gather time on the root, and
+   the kernel time is the slowest local addition.
+
+   In pipelined mode, the block of each rank is cut into K sub-chunks
+   exchanged with MPI_Isend/MPI_Irecv. A rank adds a sub-chunk as soon
+   as MPI_Waitany tells it has arrived, while the next ones are still
+   being received and the previous results are being sent back, and the
+   root adds its own block while all its messages are in flight. There
+   is no global synchronization at all. For each size, every rank also
+   reports on the error output its compute time, its time blocked in MPI
+   and its overlap ratio, which is the fraction of its compute time done
+   while some of its messages were still in flight.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+#include "aligned_allocator.hpp"
+#include "benchmark.hpp"
+#ifdef WITH_OPENCL
+#include "opencl_runtime.hpp"
+#endif
+
+using vector = std::vector<float, memory::aligned_allocator<float>>;
+
+
+void checkError(int err) {
+  if (err != MPI_SUCCESS) {
+    int err_length = MPI_MAX_ERROR_STRING;
+    char err_buffer[MPI_MAX_ERROR_STRING];
+    MPI_Error_string(err, err_buffer, &err_length);
+    throw std::domain_error("MPI ERROR: " + std::string(err_buffer));
+  }
+}
+
+
+/// The local addition of a block
+class local_add {
+
+public:
+
+  virtual ~local_add() {}
+
+  /// Compute c = a + b on n elements
+  virtual void operator()(const float *a, const float *b, float *c,
+                          std::size_t n) = 0;
+};
+
+
+/// Vectorized addition on the core of the rank
+struct host_add : local_add {
+  void operator()(const float *a, const float *b, float *c,
+                  std::size_t n) override {
+#pragma omp simd
+    for (std::size_t i = 0; i < n; ++i)
+      c[i] = a[i] + b[i];
+  }
+};
+
+
+/// Vectorized addition on all the cores given to the rank
+struct openmp_add : local_add {
+  void operator()(const float *a, const float *b, float *c,
+                  std::size_t n) override {
+#pragma omp parallel for simd schedule(static)
+    for (std::size_t i = 0; i < n; ++i)
+      c[i] = a[i] + b[i];
+  }
+};
+
+
+#ifdef WITH_OPENCL
+/// Offload the addition to an OpenCL device of the node
+class opencl_add : public local_add {
+  std::unique_ptr<ocl::runtime> rt;
+  cl_kernel kernel;
+
+public:
+
+  opencl_add() {
+    // Spread the ranks of the same node over the devices of the node
+    MPI_Comm node;
+    checkError(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                                   MPI_INFO_NULL, &node));
+    int local_rank;
+    checkError(MPI_Comm_rank(node, &local_rank));
+    checkError(MPI_Comm_free(&node));
+    auto devices = ocl::devices();
+    if (devices.empty())
+      throw std::domain_error("No OpenCL device found");
+    rt.reset(new ocl::runtime { devices[local_rank % devices.size()] });
+    kernel = rt->kernel(R"(
+__kernel void vector_add(const __global float *a,
+                         const __global float *b,
+                         __global float *c) {
+  c[get_global_id(0)] = a[get_global_id(0)] + b[get_global_id(0)];
+}
+)", "vector_add");
+  }
+
+  void operator()(const float *a, const float *b, float *c,
+                  std::size_t n) override {
+    if (!n)
+      return;
+    auto size = n*sizeof(float);
+    auto q = rt->queue();
+    // The pool keeps the buffers from one call to the other
+    auto buffer_a = rt->buffers().acquire(size, CL_MEM_READ_ONLY);
+    auto buffer_b = rt->buffers().acquire(size, CL_MEM_READ_ONLY);
+    auto buffer_c = rt->buffers().acquire(size, CL_MEM_WRITE_ONLY);
+    OCL_ERROR(clEnqueueWriteBuffer(q, buffer_a, CL_FALSE, 0, size, a,
+                                   0, NULL, NULL));
+    OCL_ERROR(clEnqueueWriteBuffer(q, buffer_b, CL_FALSE, 0, size, b,
+                                   0, NULL, NULL));
+    ocl::set_args(kernel, buffer_a, buffer_b, buffer_c);
+    const size_t global_work_size { n };
+    OCL_ERROR(clEnqueueNDRangeKernel(q, kernel, 1, NULL, &global_work_size,
+                                     NULL, 0, NULL, NULL));
+    OCL_ERROR(clEnqueueReadBuffer(q, buffer_c, CL_TRUE, 0, size, c,
+                                  0, NULL, NULL));
+  }
+};
+#endif
+
+
+std::unique_ptr<local_add> make_local_add(const std::string &device) {
+  if (device == "host")
+    return std::unique_ptr<local_add> { new host_add };
+  if (device == "openmp")
+    return std::unique_ptr<local_add> { new openmp_add };
+#ifdef WITH_OPENCL
+  if (device == "opencl")
+    return std::unique_ptr<local_add> { new opencl_add };
+#endif
+  throw std::invalid_argument("Unknown or unavailable device " + device);
+}
+
+
+/** The contiguous blocks of n elements over some ranks, as counts and
+    displacements for MPI_Scatterv and MPI_Gatherv
+
+    The first n % ranks ranks get 1 more element. The end of each block
+    has to fit in an int.
+*/
+struct blocks {
+  std::vector<int> counts;
+  std::vector<int> displacements;
+
+  blocks(std::size_t n, int ranks) {
+    std::size_t offset = 0;
+    for (int r = 0; r < ranks; ++r) {
+      auto count = n/ranks + (std::size_t(r) < n % ranks);
+      // The displacements are int too, so the whole block has to fit
+      if (offset + count > std::size_t(std::numeric_limits<int>::max()))
+        throw std::invalid_argument("Block too big for MPI counts and "
+                                    "displacements");
+      counts.push_back(count);
+      displacements.push_back(offset);
+      offset += count;
+    }
+  }
+};
+
+
+/// The sub-chunk k out of some chunks of a block of n elements
+std::pair<std::size_t, std::size_t> chunk(std::size_t n, int chunks, int k) {
+  return { n*k/chunks, n*(k + 1)/chunks };
+}
+
+
+/// What a rank did during a pipelined vector addition
+struct pipeline_stats {
+  // The wall-clock time of the rank
+  double total = 0;
+  // The time spent adding
+  double compute = 0;
+  // The time blocked waiting for some messages
+  double wait = 0;
+  // The compute time while some messages were still in flight
+  double overlapped = 0;
+};
+
+
+/** The pipelined vector addition, with the same data layout as the
+    collective one
+
+    \param[in] a, b and c are the full vectors, only used on the root
+
+    \param[in] local_a, local_b and local_c are the blocks of the rank
+*/
+pipeline_stats pipelined(int rank, const blocks &d, int chunks,
+                         local_add &add, const float *a, const float *b,
+                         float *c, float *local_a, float *local_b,
+                         float *local_c) {
+  pipeline_stats s;
+  auto start = MPI_Wtime();
+  if (rank == 0) {
+    /* Post everything upfront, chunk after chunk so that all the ranks
+       can start as soon as possible. The results are received directly
+       in place in c */
+    std::vector<MPI_Request> requests;
+    for (int k = 0; k < chunks; ++k)
+      for (std::size_t r = 1; r < d.counts.size(); ++r) {
+        auto ch = chunk(d.counts[r], chunks, k);
+        auto offset = d.displacements[r] + ch.first;
+        int n = ch.second - ch.first;
+        requests.resize(requests.size() + 3);
+        auto req = &requests[requests.size() - 3];
+        checkError(MPI_Isend(a + offset, n, MPI_FLOAT, r, 2*k,
+                             MPI_COMM_WORLD, &req[0]));
+        checkError(MPI_Isend(b + offset, n, MPI_FLOAT, r, 2*k + 1,
+                             MPI_COMM_WORLD, &req[1]));
+        checkError(MPI_Irecv(c + offset, n, MPI_FLOAT, r, k,
+                             MPI_COMM_WORLD, &req[2]));
+      }
+    // The root block is added while the messages are in flight
+    auto t = MPI_Wtime();
+    add(a, b, c, d.counts[0]);
+    s.compute = MPI_Wtime() - t;
+    if (!requests.empty())
+      s.overlapped = s.compute;
+    t = MPI_Wtime();
+    checkError(MPI_Waitall(requests.size(), requests.data(),
+                           MPI_STATUSES_IGNORE));
+    s.wait = MPI_Wtime() - t;
+  }
+  else {
+    std::size_t n = d.counts[rank];
+    // The receives of a and b for chunk k are at 2k and 2k + 1
+    std::vector<MPI_Request> receives(2*chunks);
+    std::vector<MPI_Request> sends(chunks, MPI_REQUEST_NULL);
+    for (int k = 0; k < chunks; ++k) {
+      auto ch = chunk(n, chunks, k);
+      int size = ch.second - ch.first;
+      checkError(MPI_Irecv(local_a + ch.first, size, MPI_FLOAT, 0, 2*k,
+                           MPI_COMM_WORLD, &receives[2*k]));
+      checkError(MPI_Irecv(local_b + ch.first, size, MPI_FLOAT, 0, 2*k + 1,
+                           MPI_COMM_WORLD, &receives[2*k + 1]));
+    }
+    std::vector<int> arrived(chunks);
+    for (int received = 0; received < 2*chunks; ++received) {
+      int index;
+      auto t = MPI_Wtime();
+      checkError(MPI_Waitany(receives.size(), receives.data(), &index,
+                             MPI_STATUS_IGNORE));
+      s.wait += MPI_Wtime() - t;
+      auto k = index/2;
+      // Wait for both the chunks of a and b
+      if (++arrived[k] != 2)
+        continue;
+      int sent;
+      checkError(MPI_Testall(k, sends.data(), &sent, MPI_STATUSES_IGNORE));
+      auto in_flight = received + 1 < 2*chunks || !sent;
+      auto ch = chunk(n, chunks, k);
+      int size = ch.second - ch.first;
+      t = MPI_Wtime();
+      add(local_a + ch.first, local_b + ch.first, local_c + ch.first, size);
+      auto dt = MPI_Wtime() - t;
+      s.compute += dt;
+      if (in_flight)
+        s.overlapped += dt;
+      checkError(MPI_Isend(local_c + ch.first, size, MPI_FLOAT, 0, k,
+                           MPI_COMM_WORLD, &sends[k]));
+    }
+    auto t = MPI_Wtime();
+    checkError(MPI_Waitall(sends.size(), sends.data(), MPI_STATUSES_IGNORE));
+    s.wait += MPI_Wtime() - t;
+  }
+  s.total = MPI_Wtime() - start;
+  return s;
+}
+
+
+int main(int argc, char *argv[]) {
+  checkError(MPI_Init(&argc, &argv));
+
+  int rank, size;
+  checkError(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+  checkError(MPI_Comm_size(MPI_COMM_WORLD, &size));
+
+  benchmark::options o { argc, argv };
+  bool weak = false;
+  std::string device = "host";
+  // The number of sub-chunks per rank in pipelined mode, 0 otherwise
+  int chunks = 0;
+  for (auto &arg : o.extra)
+    if (arg == "--weak")
+      weak = true;
+    else if (arg.compare(0, 9, "--device=") == 0)
+      device = arg.substr(9);
+    else if (arg.compare(0, 11, "--pipeline=") == 0)
+      chunks = std::max(1, std::stoi(arg.substr(11)));
+    else
+      throw std::invalid_argument("Unknown option " + arg);
+  auto add = make_local_add(device);
+
+  // Only the root reports
+  std::unique_ptr<benchmark::reporter> report;
+  if (rank == 0)
+    report.reset(new benchmark::reporter { std::cout, o.format });
+  auto name = std::string { chunks ? "mpi_pipeline" : "mpi_scatterv" }
+    + "_" + device + "_np" + std::to_string(size) + (weak ? "_weak" : "");
+
+  for (auto step : o.sizes()) {
+    auto n = weak ? step*size : step;
+    blocks d { n, size };
+    // Only the root has the full vectors
+    vector a, b, c;
+    if (rank == 0) {
+      a.resize(n);
+      b.resize(n);
+      c.resize(n);
+      // Use small integers so that the float results are exact
+      for (std::size_t i = 0; i < n; ++i) {
+        a[i] = i % 1000;
+        b[i] = 2*(i % 1000);
+      }
+    }
+    auto local_n = d.counts[rank];
+    vector local_a(local_n), local_b(local_n), local_c(local_n);
+
+    // The statistics of the last pipelined run
+    pipeline_stats stats;
+    auto samples = benchmark::measure(o, [&] {
+        benchmark::sample s;
+        if (chunks) {
+          stats = pipelined(rank, d, chunks, *add, a.data(), b.data(),
+                            c.data(), local_a.data(), local_b.data(),
+                            local_c.data());
+          checkError(MPI_Reduce(&stats.compute, &s.kernel, 1, MPI_DOUBLE,
+                                MPI_MAX, 0, MPI_COMM_WORLD));
+          s.transfer = stats.total - s.kernel;
+          return s;
+        }
+        auto start = MPI_Wtime();
+        checkError(MPI_Scatterv(a.data(), d.counts.data(),
+                                d.displacements.data(), MPI_FLOAT,
+                                local_a.data(), local_n, MPI_FLOAT, 0,
+                                MPI_COMM_WORLD));
+        checkError(MPI_Scatterv(b.data(), d.counts.data(),
+                                d.displacements.data(), MPI_FLOAT,
+                                local_b.data(), local_n, MPI_FLOAT, 0,
+                                MPI_COMM_WORLD));
+        auto scattered = MPI_Wtime();
+        (*add)(local_a.data(), local_b.data(), local_c.data(), local_n);
+        auto added = MPI_Wtime();
+        checkError(MPI_Gatherv(local_c.data(), local_n, MPI_FLOAT,
+                               c.data(), d.counts.data(),
+                               d.displacements.data(), MPI_FLOAT, 0,
+                               MPI_COMM_WORLD));
+        auto gathered = MPI_Wtime();
+        // The slowest rank gives the compute time
+        double kernel = added - scattered;
+        checkError(MPI_Reduce(&kernel, &s.kernel, 1, MPI_DOUBLE, MPI_MAX, 0,
+                              MPI_COMM_WORLD));
+        s.transfer = (gathered - start) - s.kernel;
+        return s;
+      });
+
+    if (chunks) {
+      std::vector<pipeline_stats> all(size);
+      checkError(MPI_Gather(&stats, 4, MPI_DOUBLE, all.data(), 4,
+                            MPI_DOUBLE, 0, MPI_COMM_WORLD));
+      if (rank == 0)
+        for (int r = 0; r < size; ++r)
+          std::cerr << "# " << name << " size " << n << " rank " << r
+                    << ": compute " << all[r].compute << " s, wait "
+                    << all[r].wait << " s, total " << all[r].total
+                    << " s, overlap ratio "
+                    << (all[r].compute > 0
+                        ? all[r].overlapped/all[r].compute : 0)
+                    << std::endl;
+    }
+
+    if (rank == 0) {
+      for (std::size_t i = 0; i < n; ++i)
+        if (c[i] != a[i] + b[i])
+          throw std::runtime_error("Wrong result at index "
+                                   + std::to_string(i));
+      (*report)({ name, n, 3*n*sizeof(float), samples });
+    }
+  }
+  report.reset();
+
+  checkError(MPI_Finalize());
+  return 0;
+}
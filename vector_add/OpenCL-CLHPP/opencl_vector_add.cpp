@@ -4,6 +4,8 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <CL/cl2.hpp>
 
+#include "opencl_program_cache.hpp"
+
 constexpr size_t N = 3;
 using Vector = float[N];
 
@@ -28,8 +30,12 @@ __kernel void vector_add(const __global float *a,
 }
 )";
 
-  // Compile and build the program
-  cl::Program p { kernel_source, true };
+  /* Compile and build the program for the default device, or just load
+     its binary from the on-disk cache if it has already been built for
+     this device and driver. cl::Program takes the ownership */
+  cl::Program p { ocl::build_program(cl::Context::getDefault()(),
+                                     cl::Device::getDefault()(),
+                                     kernel_source) };
   // Create the kernel functor taking 3 buffers as parameter
   cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer> k { p, "vector_add" };
 
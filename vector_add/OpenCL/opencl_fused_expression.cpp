@@ -0,0 +1,107 @@
+/* A chain of elementwise operations fused into 1 OpenCL kernel
+
+   Compute e = a + b*k - d on device vectors with fused_expression.hpp,
+   either as 1 fused kernel or as 1 kernel per operation with
+   temporaries, as hardcoded kernels would do, and compare the times.
+   Memory-bound, the fused version does 1 pass over the memory instead
+   of 3.
+
+   Then compute 2 outputs from the same inputs with 1 kernel, and
+   evaluate the same expression with another scalar, which reuses the
+   kernel already built.
+
+   Usage: opencl_fused_expression [number of elements]
+
+   The device can be chosen with the environment variables of
+   opencl_runtime.hpp.
+*/
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "fused_expression.hpp"
+#include "opencl_runtime.hpp"
+
+/// Time an operation finished on the device
+template <typename Operation>
+double time(ocl::runtime &rt, Operation op) {
+  auto start = benchmark::clock::now();
+  op();
+  rt.finish();
+  return benchmark::seconds(start, benchmark::clock::now());
+}
+
+
+/// Check the result on the host
+void check(const fused::vector<float> &v, const std::vector<float> &expected,
+           const std::string &name) {
+  std::vector<float> r(v.size());
+  v.read(r.data());
+  if (r != expected)
+    THROW_ERROR("Wrong result for " + name);
+}
+
+
+int main(int argc, char *argv[]) {
+  const std::size_t n = argc > 1 ? benchmark::parse_size(argv[1]) : 1 << 24;
+  ocl::runtime rt;
+  std::cout << ocl::device_info(rt.device(), CL_DEVICE_NAME) << std::endl;
+
+  // Small integers so that the float results are exact
+  std::vector<float> host_a(n), host_b(n), host_d(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    host_a[i] = i % 1000;
+    host_b[i] = i % 7;
+    host_d[i] = i % 3;
+  }
+  fused::vector<float> a { rt, host_a.data(), n };
+  fused::vector<float> b { rt, host_b.data(), n };
+  fused::vector<float> d { rt, host_d.data(), n };
+  fused::vector<float> e { rt, n }, f { rt, n }, t { rt, n };
+  auto expected = [&] (float k) {
+    std::vector<float> r(n);
+    for (std::size_t i = 0; i < n; ++i)
+      r[i] = host_a[i] + host_b[i]*k - host_d[i];
+    return r;
+  };
+
+  // The first evaluations build the kernels
+  e = a + b*2.f - d;
+  t = b*2.f;
+  t = a + t;
+  e = t - d;
+  rt.finish();
+
+  auto fused_time = time(rt, [&] { e = a + b*2.f - d; });
+  check(e, expected(2), "the fused expression");
+  auto separate_time = time(rt, [&] {
+      t = b*2.f;
+      t = a + t;
+      e = t - d;
+    });
+  check(e, expected(2), "the separate operations");
+  // Each pass reads 2 vectors and writes 1, except the first one
+  auto bytes = n*sizeof(float);
+  std::cout << "Fused, 1 pass: " << fused_time << " s, "
+            << 4*bytes/fused_time*1e-9 << " GB/s" << std::endl
+            << "Separate, 3 passes: " << separate_time << " s, "
+            << 8*bytes/separate_time*1e-9 << " GB/s" << std::endl;
+
+  // 2 outputs reading a, b and d only once
+  fused::evaluate(rt, e, a + b*3.f - d, f, -(a*b));
+  check(e, expected(3), "the first output");
+  std::vector<float> product(n);
+  for (std::size_t i = 0; i < n; ++i)
+    product[i] = -(host_a[i]*host_b[i]);
+  check(f, product, "the second output");
+
+  // Another scalar is just another kernel argument, no new build
+  auto reuse_time = time(rt, [&] { e = a + b*5.f - d; });
+  check(e, expected(5), "another scalar");
+  std::cout << "Same expression with another scalar: " << reuse_time
+            << " s" << std::endl;
+  ocl::profiler::instance().report();
+}
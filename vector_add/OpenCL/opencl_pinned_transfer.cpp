@@ -0,0 +1,95 @@
+/* Compare the transfer bandwidth from pageable and pinned host memory
+
+   For each size, a device buffer is written from and read to host
+   vectors allocated:
+
+   - pageable: by the usual std::allocator;
+
+   - alloc_host_ptr: from the mapped CL_MEM_ALLOC_HOST_PTR buffers of an
+     ocl::pinned_pool;
+
+   - mlock: from the page-aligned mlock()ed memory of an
+     ocl::pinned_pool.
+
+   The pools are shared by all the sizes, so the memory is pinned only
+   once per size class, as a service reusing its staging vectors would.
+
+   Usage: opencl_pinned_transfer [benchmark options], see benchmark.hpp,
+   for example --max=16Mi to stay within the memory of a small device.
+
+   The device can be chosen with the environment variables of
+   opencl_runtime.hpp.
+*/
+
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "opencl_pinned_memory.hpp"
+#include "opencl_runtime.hpp"
+
+/// Measure the writes and reads of n floats from some host vector
+template <typename Vector>
+void measure(const benchmark::options &o, benchmark::reporter &report,
+             ocl::runtime &rt, Vector &host, const std::string &name) {
+  auto n = host.size();
+  auto bytes = n*sizeof(float);
+  auto device = rt.buffers().acquire(bytes);
+  for (auto write : { true, false }) {
+    // The name of the profiled commands, built once
+    auto command = name + (write ? " write" : " read");
+    auto samples = benchmark::measure(o, [&] {
+        benchmark::sample s;
+        {
+          benchmark::stopwatch sw { s.transfer };
+          auto status = write
+            ? clEnqueueWriteBuffer(rt.queue(), device, CL_TRUE, 0, bytes,
+                                   host.data(), 0, NULL,
+                                   ocl::profile(command.c_str()))
+            : clEnqueueReadBuffer(rt.queue(), device, CL_TRUE, 0, bytes,
+                                  host.data(), 0, NULL,
+                                  ocl::profile(command.c_str()));
+          ocl::check(status, write ? "clEnqueueWriteBuffer"
+                                   : "clEnqueueReadBuffer");
+        }
+        return s;
+      });
+    report({ name + (write ? "_write" : "_read"), n, bytes, samples });
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  benchmark::options o { argc, argv };
+  if (!o.extra.empty())
+    throw std::invalid_argument { "Unknown option " + o.extra.front() };
+  ocl::runtime rt;
+  std::clog << ocl::device_info(rt.device(), CL_DEVICE_NAME) << std::endl;
+  using pinning = ocl::pinned_pool::pinning;
+  ocl::pinned_pool mapped { rt.context(), rt.queue(),
+                            pinning::alloc_host_ptr };
+  ocl::pinned_pool locked { rt.context(), rt.queue(), pinning::mlock };
+
+  benchmark::reporter report { std::cout, o.format };
+  for (auto n : o.sizes()) {
+    if (o.selected("pageable")) {
+      std::vector<float> host(n, 1);
+      measure(o, report, rt, host, "pageable");
+    }
+    if (o.selected("alloc_host_ptr")) {
+      std::vector<float, ocl::pinned_allocator<float>> host(n, 1, mapped);
+      measure(o, report, rt, host, "alloc_host_ptr");
+    }
+    if (o.selected("mlock")) {
+      std::vector<float, ocl::pinned_allocator<float>> host(n, 1, locked);
+      measure(o, report, rt, host, "mlock");
+    }
+  }
+  if (locked.unpinned())
+    std::clog << locked.unpinned() << " blocks could not be locked, see "
+      "ulimit -l" << std::endl;
+  ocl::profiler::instance().report();
+}
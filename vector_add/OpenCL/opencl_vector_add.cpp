@@ -1,104 +1,104 @@
-#include <iostream>
-#include <string>
-#include <vector>
+/* Vector addition with the OpenCL C API
 
-#if defined(__APPLE__)
-#include <OpenCL/cl.h>
-#else
-#include <CL/cl.h>
-#endif
+   The memory mode can be chosen on the command line:
 
-/* Transform the value of a given symbol to a string. Since we expect a
-   macro symbol, use a double evaluation... */
-#define _strinG(s) #s
+   - copy (default): device buffers with explicit write and read;
 
-#define _stringifY(s) _strinG(s)
+   - use_host_ptr: the buffers use the page-aligned host arrays
+     directly with CL_MEM_USE_HOST_PTR and the output is mapped back;
 
-/** Throw a nicer error message in the code by adding the file name and
-    the position */
-#define THROW_ERROR(message)                                            \
-  throw std::domain_error(std::string("In file " __FILE__ " at line "   \
-                                      _stringifY(__LINE__) "\n") + message)
+   - alloc_host_ptr: the implementation allocates host-accessible
+     buffers with CL_MEM_ALLOC_HOST_PTR which are filled and read
+     through map/unmap;
 
-/** Test for an OpenCL error and display a message */
-#define OCL_TEST_ERROR_MSG(status, msg) do {                            \
-    if ((status) !=  CL_SUCCESS)                                        \
-      THROW_ERROR(std::string(msg) + std::to_string(status));           \
-  } while(0)
+   - svm: coarse-grain shared virtual memory from OpenCL 2.x, accessed
+     by the host through map/unmap.
 
-  /** Do an OpenCL function call and test for execution error */
-#define OCL_ERROR(func) do {                                            \
-    cl_int _st = func;                                                  \
-    if (_st !=  CL_SUCCESS)                                             \
-      THROW_ERROR(_stringifY(func) " returns error " + std::to_string(_st)); \
-  } while(0)
+   Except for copy, there is no copy at all on CPU and integrated
+   devices sharing the memory with the host.
 
-constexpr size_t N = 3;
+   The device can be chosen with the OPENCL_DEVICE_TYPE, OPENCL_VENDOR
+   and OPENCL_DEVICE environment variables, see opencl_runtime.hpp.
+   Without any suitable device, the addition falls back to the SIMD
+   host implementation of host_simd.hpp.
 
-using Vector = float[N];
+   Run with OPENCL_PROFILE=trace.json to get a trace and a summary of
+   the OpenCL commands, see opencl_profiler.hpp.
+*/
 
-int main() {
-  Vector a = { 1, 2, 3 };
-  Vector b = { 5, 6, 8 };
-  Vector c;
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
 
-  cl_int status;
+#include "host_simd.hpp"
+#include "opencl_runtime.hpp"
 
-  // Get the number of OpenCL platforms on the machine
-  cl_uint num_platforms;
-  OCL_ERROR(clGetPlatformIDs(0, NULL, &num_platforms));
-
-  std::vector<cl_platform_id> platforms(num_platforms);
-  OCL_ERROR(clGetPlatformIDs(num_platforms, platforms.data(), NULL));
-
-
-  cl_context context;
-  bool found_context = false;
-  for (auto platform : platforms) {
-    std::cout << platform << std::endl;
-    // Describe the context to query
-    cl_context_properties cps[] = {
-      CL_CONTEXT_PLATFORM, (cl_context_properties)platform,
-      0
-    };
-    // Create an OpenCL context from our platform
-    context = clCreateContextFromType(cps,
-                                      CL_DEVICE_TYPE_ALL,
-                                      NULL,
-                                      NULL,
-                                      &status);
-    if (status ==  CL_SUCCESS) {
-      found_context = true;
-      break;
-    }
-  }
-  if (!found_context)
-    THROW_ERROR("Cannot found a context");
+#ifndef VECTOR_ADD_DEVICE_TYPE
+/** The type of device to use, set to CL_DEVICE_TYPE_GPU by the Makefile
+    for opencl_vector_add_gpu */
+#define VECTOR_ADD_DEVICE_TYPE CL_DEVICE_TYPE_ALL
+#endif
 
-  // Get the first device
-  cl_device_id device;
-  OCL_ERROR(clGetContextInfo(context, CL_CONTEXT_DEVICES,
-                             sizeof(device), &device, NULL));
+constexpr size_t N = 3;
 
-  // Create an OpenCL command queue
-  cl_command_queue command_queue =
-    clCreateCommandQueueWithProperties(context, device, NULL, &status);
-  OCL_TEST_ERROR_MSG(status, "Cannot create the command queue");
+using Vector = float[N];
 
-  // The input buffers for OpenCL
-   cl_mem buffer_a =
-     clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(a), NULL, &status);
-   OCL_TEST_ERROR_MSG(status, "Cannot create buffer_a");
-   cl_mem buffer_b =
-     clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(b), NULL, &status);
-   OCL_TEST_ERROR_MSG(status, "Cannot create buffer_b");
+const Vector init_a = { 1, 2, 3 };
+const Vector init_b = { 5, 6, 8 };
+
+enum class memory_mode { copy, use_host_ptr, alloc_host_ptr, svm };
+
+memory_mode parse_mode(int argc, char *argv[]) {
+  std::string mode = argc > 1 ? argv[1] : "copy";
+  if (mode == "copy")
+    return memory_mode::copy;
+  if (mode == "use_host_ptr")
+    return memory_mode::use_host_ptr;
+  if (mode == "alloc_host_ptr")
+    return memory_mode::alloc_host_ptr;
+  if (mode == "svm")
+    return memory_mode::svm;
+  THROW_ERROR("Unknown memory mode " + mode);
+}
 
-  // The output buffer for OpenCL
-   cl_mem buffer_c =
-     clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(c), NULL, &status);
-   OCL_TEST_ERROR_MSG(status, "Cannot create buffer_c");
+void print(const float *c) {
+  std::cout << std::endl << "Result:" << std::endl;
+  for (std::size_t i = 0; i < N; ++i)
+    std::cout << c[i] << " ";
+  std::cout << std::endl;
+}
 
-  // Construct an OpenCL program from the source file
+int main(int argc, char *argv[]) {
+  auto mode = parse_mode(argc, argv);
+  /* Page-aligned host arrays, so that the implementation can use them
+     directly with CL_MEM_USE_HOST_PTR */
+  alignas(4096) Vector a = { 1, 2, 3 };
+  alignas(4096) Vector b = { 5, 6, 8 };
+  alignas(4096) Vector c;
+
+  cl_int status;
+
+  /* Create an OpenCL context and command queue on the first device of
+     the requested type. All the OpenCL objects are released
+     automatically at the end */
+  std::unique_ptr<ocl::runtime> accelerator;
+  try {
+    accelerator.reset(new ocl::runtime { VECTOR_ADD_DEVICE_TYPE });
+  } catch (std::exception &e) {
+    std::cout << "No OpenCL device (" << e.what() << "), using the host "
+              << simd::name(simd::best()) << " implementation" << std::endl;
+    simd::add(a, b, c, N);
+    print(c);
+    return 0;
+  }
+  auto &rt = *accelerator;
+  std::cout << ocl::device_info(rt.device(), CL_DEVICE_NAME) << std::endl;
+  auto command_queue = rt.queue();
+
+  // The OpenCL program source
   const char kernel_source[] = R"(
 __kernel void vector_add(const __global float *a,
                          const __global float *b,
@@ -106,72 +106,135 @@ __kernel void vector_add(const __global float *a,
   c[get_global_id(0)] = a[get_global_id(0)] + b[get_global_id(0)];
 }
 )";
-  const char *kernel_sources = kernel_source;
-  const size_t kernel_size = sizeof(kernel_source);
-  cl_program program = clCreateProgramWithSource(context, 1, &kernel_sources,
-                                                 &kernel_size, &status);
-  OCL_TEST_ERROR_MSG(status, "Cannot create program");
+  /* Build the program, or just load its binary from the on-disk cache if
+     it has already been built for this device and driver */
+  cl_kernel kernel = rt.kernel(kernel_source, "vector_add");
+
+  const size_t global_work_size { N };
+
+  if (mode == memory_mode::svm) {
+    if (!(ocl::device_info<cl_device_svm_capabilities>
+          (rt.device(), CL_DEVICE_SVM_CAPABILITIES)
+          & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER))
+      THROW_ERROR("The device does not support coarse-grain SVM");
+
+    // The shared allocations, usable as is by the host and the kernel
+    auto svm_a = ocl::svm_alloc<float>(rt.context(), N, CL_MEM_READ_ONLY);
+    auto svm_b = ocl::svm_alloc<float>(rt.context(), N, CL_MEM_READ_ONLY);
+    auto svm_c = ocl::svm_alloc<float>(rt.context(), N, CL_MEM_WRITE_ONLY);
+
+    // With coarse-grain SVM, the host has to map the memory to access it
+    OCL_ERROR(clEnqueueSVMMap(command_queue, CL_TRUE,
+                              CL_MAP_WRITE_INVALIDATE_REGION, svm_a.get(),
+                              sizeof(a), 0, NULL, ocl::profile("map a")));
+    OCL_ERROR(clEnqueueSVMMap(command_queue, CL_TRUE,
+                              CL_MAP_WRITE_INVALIDATE_REGION, svm_b.get(),
+                              sizeof(b), 0, NULL, ocl::profile("map b")));
+    // Produce the input data directly in the shared memory
+    std::memcpy(svm_a.get(), init_a, sizeof(init_a));
+    std::memcpy(svm_b.get(), init_b, sizeof(init_b));
+    OCL_ERROR(clEnqueueSVMUnmap(command_queue, svm_a.get(), 0, NULL,
+                                ocl::profile("unmap a")));
+    OCL_ERROR(clEnqueueSVMUnmap(command_queue, svm_b.get(), 0, NULL,
+                                ocl::profile("unmap b")));
+
+    OCL_ERROR(clSetKernelArgSVMPointer(kernel, 0, svm_a.get()));
+    OCL_ERROR(clSetKernelArgSVMPointer(kernel, 1, svm_b.get()));
+    OCL_ERROR(clSetKernelArgSVMPointer(kernel, 2, svm_c.get()));
+
+    // Launch the kernel
+    OCL_ERROR(clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL,
+                                     &global_work_size, NULL,
+                                     0, NULL, ocl::profile("vector_add")));
+
+    // Map the output to read it from the host
+    OCL_ERROR(clEnqueueSVMMap(command_queue, CL_TRUE, CL_MAP_READ,
+                              svm_c.get(), sizeof(c), 0, NULL,
+                              ocl::profile("map c")));
+    print(svm_c.get());
+    OCL_ERROR(clEnqueueSVMUnmap(command_queue, svm_c.get(), 0, NULL,
+                                ocl::profile("unmap c")));
+    // The SVM has to be unused before being freed
+    rt.finish();
+    ocl::profiler::instance().report();
+    return 0;
+  }
 
-  OCL_ERROR(clBuildProgram(program, 1, &device, "", NULL, NULL));
+  // The memory flags and host pointers of the buffers for the mode
+  cl_mem_flags extra_flags = 0;
+  void *host_a = NULL, *host_b = NULL, *host_c = NULL;
+  if (mode == memory_mode::use_host_ptr) {
+    extra_flags = CL_MEM_USE_HOST_PTR;
+    host_a = a;
+    host_b = b;
+    host_c = c;
+  }
+  else if (mode == memory_mode::alloc_host_ptr)
+    extra_flags = CL_MEM_ALLOC_HOST_PTR;
 
-  cl_kernel kernel = clCreateKernel(program, "vector_add", &status);
-  OCL_TEST_ERROR_MSG(status, "Cannot find the kernel");
+  // The input buffers for OpenCL
+  auto buffer_a = ocl::create_buffer(rt.context(),
+                                     CL_MEM_READ_ONLY | extra_flags,
+                                     sizeof(a), host_a);
+  auto buffer_b = ocl::create_buffer(rt.context(),
+                                     CL_MEM_READ_ONLY | extra_flags,
+                                     sizeof(b), host_b);
 
-  // Send the input data to the accelerator
-  OCL_ERROR(clEnqueueWriteBuffer(command_queue, buffer_a, true, 0 /* Offset */,
-                                 sizeof(a), &a[0], 0, NULL, NULL));
-  OCL_ERROR(clEnqueueWriteBuffer(command_queue, buffer_b, true, 0 /* Offset */,
-                                 sizeof(b), &b[0], 0, NULL, NULL));
+  // The output buffer for OpenCL
+  auto buffer_c = ocl::create_buffer(rt.context(),
+                                     CL_MEM_WRITE_ONLY | extra_flags,
+                                     sizeof(c), host_c);
+
+  if (mode == memory_mode::copy) {
+    // Send the input data to the accelerator
+    OCL_ERROR(clEnqueueWriteBuffer(command_queue, buffer_a, true,
+                                   0 /* Offset */, sizeof(a), &a[0],
+                                   0, NULL, ocl::profile("write a")));
+    OCL_ERROR(clEnqueueWriteBuffer(command_queue, buffer_b, true,
+                                   0 /* Offset */, sizeof(b), &b[0],
+                                   0, NULL, ocl::profile("write b")));
+  }
+  else if (mode == memory_mode::alloc_host_ptr) {
+    // Produce the input data directly in the mapped buffers
+    for (auto ab : { std::make_pair(buffer_a.get(), init_a),
+                     std::make_pair(buffer_b.get(), init_b) }) {
+      auto p = clEnqueueMapBuffer(command_queue, ab.first, CL_TRUE,
+                                  CL_MAP_WRITE_INVALIDATE_REGION, 0,
+                                  sizeof(Vector), 0, NULL,
+                                  ocl::profile("map input"), &status);
+      OCL_TEST_ERROR_MSG(status, "Cannot map an input buffer");
+      std::memcpy(p, ab.second, sizeof(Vector));
+      OCL_ERROR(clEnqueueUnmapMemObject(command_queue, ab.first, p,
+                                        0, NULL, ocl::profile("unmap input")));
+    }
+  }
+  // Nothing to do with use_host_ptr, the buffers are already a and b
 
-  OCL_ERROR(clSetKernelArg(kernel, 0, sizeof(buffer_a), &buffer_a));
-  OCL_ERROR(clSetKernelArg(kernel, 1, sizeof(buffer_b), &buffer_b));
-  OCL_ERROR(clSetKernelArg(kernel, 2, sizeof(buffer_c), &buffer_c));
+  ocl::set_args(kernel, buffer_a, buffer_b, buffer_c);
 
   // Launch the kernel
-  const size_t global_work_size { N };
   OCL_ERROR(clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL,
                                    &global_work_size, NULL,
-                                   0, NULL, NULL));
-
-  // Get the output data from the accelerator
-  OCL_ERROR(clEnqueueReadBuffer(command_queue, buffer_c, true, 0 /* Offset */,
-                                sizeof(c), &c[0], 0, NULL, NULL));
-
-
-  std::cout << std::endl << "Result:" << std::endl;
-  for(auto e : c)
-    std::cout << e << " ";
-  std::cout << std::endl;
+                                   0, NULL, ocl::profile("vector_add")));
+
+  if (mode == memory_mode::copy) {
+    // Get the output data from the accelerator
+    OCL_ERROR(clEnqueueReadBuffer(command_queue, buffer_c, true,
+                                  0 /* Offset */, sizeof(c), &c[0],
+                                  0, NULL, ocl::profile("read c")));
+    print(c);
+  }
+  else {
+    /* Map the output to read it from the host. With use_host_ptr the
+       mapped pointer is c itself */
+    auto p = clEnqueueMapBuffer(command_queue, buffer_c, CL_TRUE,
+                                CL_MAP_READ, 0, sizeof(c),
+                                0, NULL, ocl::profile("map c"), &status);
+    OCL_TEST_ERROR_MSG(status, "Cannot map buffer_c");
+    print(static_cast<float *>(p));
+    OCL_ERROR(clEnqueueUnmapMemObject(command_queue, buffer_c, p,
+                                      0, NULL, ocl::profile("unmap c")));
+    rt.finish();
+  }
+  ocl::profiler::instance().report();
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -0,0 +1,205 @@
+/* Vector addition split over all the OpenCL devices of all the platforms
+
+   Usage: opencl_vector_add_multi_device [N [iterations]]
+
+   Each device gets its own context and command queue and computes a
+   slice of the vectors proportional to its throughput. The first split
+   is a guess from the compute units and the clock frequency, and then
+   the throughput measured on each iteration rebalances the slices of
+   the next one.
+
+   The slices wrap the page-aligned host arrays with CL_MEM_USE_HOST_PTR
+   and the output is mapped back in place, so the results are merged
+   into the output array without any copy on CPU and integrated devices.
+
+   The devices can be restricted with the environment variables of
+   opencl_runtime.hpp, for example OPENCL_DEVICE_TYPE=cpu. To try it on
+   a single machine, the PoCL CPU device can be exposed several times
+   with POCL_DEVICES="pthread pthread".
+
+   Run with OPENCL_PROFILE=trace.json to see the slices of the devices
+   on their own queues, see opencl_profiler.hpp.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+#include "benchmark.hpp"
+#include "opencl_runtime.hpp"
+
+// The slices are multiple of a page to keep the host pointers aligned
+constexpr std::size_t granularity = memory::page_size/sizeof(float);
+
+using vector = std::vector<float, memory::aligned_allocator<float>>;
+
+
+/** Split n elements proportionally to some weights
+
+    \return the offsets of the slices, with a final n
+*/
+std::vector<std::size_t> split(std::size_t n,
+                               const std::vector<double> &weights) {
+  auto total = std::accumulate(weights.begin(), weights.end(), 0.);
+  std::vector<std::size_t> offsets { 0 };
+  double sum = 0;
+  for (auto w : weights) {
+    sum += w;
+    // Round the boundaries to the granularity but the last one
+    auto end = static_cast<std::size_t>(n*sum/total)
+      /granularity*granularity;
+    offsets.push_back(std::min(std::max(end, offsets.back()), n));
+  }
+  offsets.back() = n;
+  return offsets;
+}
+
+
+/// A device with its runtime and its measured throughput
+struct device {
+  std::unique_ptr<ocl::runtime> rt;
+  cl_kernel kernel;
+  // In elements per second, used as the weight of the split
+  double throughput;
+  // Whether the throughput is measured or only guessed
+  bool measured = false;
+  // The time of the last slice, in seconds
+  double time = 0;
+
+  device(cl_device_id d, const std::string &kernel_source)
+    : rt { new ocl::runtime { d } }
+    , kernel { rt->kernel(kernel_source, "vector_add") } {
+    // A first guess before any measurement
+    throughput =
+      ocl::device_info<cl_uint>(d, CL_DEVICE_MAX_COMPUTE_UNITS)
+      *double(ocl::device_info<cl_uint>(d, CL_DEVICE_MAX_CLOCK_FREQUENCY));
+  }
+
+  /// Compute c = a + b on n elements from the host arrays, in place
+  void run(const float *a, const float *b, float *c, std::size_t n) {
+    auto start = benchmark::clock::now();
+    if (n) {
+      auto size = n*sizeof(float);
+      auto buffer_a = ocl::create_buffer(rt->context(),
+                                         CL_MEM_READ_ONLY
+                                         | CL_MEM_USE_HOST_PTR, size,
+                                         const_cast<float *>(a));
+      auto buffer_b = ocl::create_buffer(rt->context(),
+                                         CL_MEM_READ_ONLY
+                                         | CL_MEM_USE_HOST_PTR, size,
+                                         const_cast<float *>(b));
+      auto buffer_c = ocl::create_buffer(rt->context(),
+                                         CL_MEM_WRITE_ONLY
+                                         | CL_MEM_USE_HOST_PTR, size, c);
+      ocl::set_args(kernel, buffer_a, buffer_b, buffer_c);
+      const size_t global_work_size { n };
+      OCL_ERROR(clEnqueueNDRangeKernel(rt->queue(), kernel, 1, NULL,
+                                       &global_work_size, NULL, 0, NULL,
+                                       ocl::profile("vector_add")));
+      /* Mapping makes the output coherent in c, which is a no-op on a
+         device sharing the memory with the host */
+      cl_int status;
+      auto p = clEnqueueMapBuffer(rt->queue(), buffer_c, CL_TRUE,
+                                  CL_MAP_READ, 0, size, 0, NULL,
+                                  ocl::profile("map c"), &status);
+      OCL_TEST_ERROR_MSG(status, "Cannot map buffer_c");
+      OCL_ERROR(clEnqueueUnmapMemObject(rt->queue(), buffer_c, p,
+                                        0, NULL, ocl::profile("unmap c")));
+      rt->finish();
+    }
+    time = benchmark::seconds(start, benchmark::clock::now());
+  }
+
+  /** Update the throughput from the last slice of n elements
+
+      The measurements are smoothed to absorb the noise, but the first
+      one replaces the guess which is not in the same unit. A device
+      without any work keeps its previous estimate.
+  */
+  void rebalance(std::size_t n) {
+    if (!n || time <= 0)
+      return;
+    throughput = measured ? (throughput + n/time)/2 : n/time;
+    measured = true;
+  }
+};
+
+
+int main(int argc, char *argv[]) {
+  const std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1 << 26;
+  const int iterations = argc > 2 ? std::stoi(argv[2]) : 10;
+
+  const char kernel_source[] = R"(
+__kernel void vector_add(const __global float *a,
+                         const __global float *b,
+                         __global float *c) {
+  c[get_global_id(0)] = a[get_global_id(0)] + b[get_global_id(0)];
+}
+)";
+
+  std::vector<device> devices;
+  for (auto d : ocl::devices()) {
+    devices.emplace_back(d, kernel_source);
+    std::cout << "Device " << devices.size() - 1 << ": "
+              << ocl::device_info(d, CL_DEVICE_NAME) << std::endl;
+  }
+  if (devices.empty())
+    THROW_ERROR("No OpenCL device found");
+
+  vector a(n), b(n), c(n);
+  for (std::size_t i = 0; i != n; ++i) {
+    a[i] = i % 1000;
+    b[i] = 2*(i % 1000);
+  }
+
+  for (int iteration = 0; iteration != iterations; ++iteration) {
+    std::vector<double> weights;
+    for (auto &d : devices)
+      weights.push_back(d.throughput);
+    auto offsets = split(n, weights);
+
+    // Run all the slices concurrently, with 1 host thread per device
+    std::vector<std::exception_ptr> errors(devices.size());
+    std::vector<std::thread> threads;
+    auto start = benchmark::clock::now();
+    for (std::size_t i = 0; i != devices.size(); ++i)
+      threads.emplace_back([&, i] {
+          try {
+            auto o = offsets[i];
+            devices[i].run(a.data() + o, b.data() + o, c.data() + o,
+                           offsets[i + 1] - o);
+          } catch (...) {
+            errors[i] = std::current_exception();
+          }
+        });
+    for (auto &t : threads)
+      t.join();
+    auto time = benchmark::seconds(start, benchmark::clock::now());
+    for (auto &e : errors)
+      if (e)
+        std::rethrow_exception(e);
+
+    std::cout << "Iteration " << iteration << ": " << time << " s, "
+              << 3*n*sizeof(float)/time/1e9 << " GB/s, slices";
+    for (std::size_t i = 0; i != devices.size(); ++i) {
+      auto slice = offsets[i + 1] - offsets[i];
+      std::cout << ' ' << std::round(1000.*slice/n)/10 << '%';
+      devices[i].rebalance(slice);
+    }
+    std::cout << std::endl;
+  }
+
+  for (std::size_t i = 0; i != n; ++i)
+    if (c[i] != a[i] + b[i])
+      THROW_ERROR("Wrong result at index " + std::to_string(i));
+  std::cout << "Result verified" << std::endl;
+  ocl::profiler::instance().report();
+}
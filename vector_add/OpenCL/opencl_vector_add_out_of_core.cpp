@@ -0,0 +1,239 @@
+/* Vector addition of float arrays on disk bigger than the memory
+
+   The input and output files are mapped in memory with
+   mapped_file.hpp and streamed in tiles through a fixed pool of device
+   buffers, without any full copy in host memory:
+
+   - the writes of tile k+1, the kernel on tile k and the read back of
+     tile k-1 overlap, each on its own in-order queue, as in
+     simple_stream/Boost.Compute/opencl_simple_stream_async.cpp;
+
+   - the next tile of the inputs is read ahead from the disk with
+     madvise() while the current one is transferred;
+
+   - the device reads the inputs from the mapped files and writes the
+     results directly into the mapped output file;
+
+   - once a tile is read back, its pages are released, so the resident
+     memory stays about (depth + 1) tiles of each file whatever the size
+     of the files.
+
+   So the throughput is bounded by the slowest of the disk, the
+   host-device link and the kernel instead of by the memory size.
+
+   Usage: opencl_vector_add_out_of_core [options]
+     --a=FILE, --b=FILE  input files of floats (default a.bin and b.bin)
+     --c=FILE            output file (default c.bin)
+     --generate=N        first create the input files with N elements
+     --tile=N            elements per tile (default 16Mi), a multiple of
+                         the page size in bytes is better
+     --depth=D           tiles in flight (default 3)
+     --check             verify the output file afterwards
+
+   The device can be chosen with the environment variables of
+   opencl_runtime.hpp.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "mapped_file.hpp"
+#include "opencl_runtime.hpp"
+
+const char kernel_source[] = R"(
+__kernel void vector_add(const __global float *a,
+                         const __global float *b,
+                         __global float *c) {
+  c[get_global_id(0)] = a[get_global_id(0)] + b[get_global_id(0)];
+}
+)";
+
+struct parameters {
+  std::string a = "a.bin";
+  std::string b = "b.bin";
+  std::string c = "c.bin";
+  std::size_t generate = 0;
+  std::size_t tile = std::size_t { 1 } << 24;
+  std::size_t depth = 3;
+  bool check = false;
+
+  parameters(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto option = benchmark::split_option(arg);
+      auto &key = option.first;
+      auto &value = option.second;
+      if (key == "--a")
+        a = value;
+      else if (key == "--b")
+        b = value;
+      else if (key == "--c")
+        c = value;
+      else if (key == "--generate")
+        generate = benchmark::parse_size(value);
+      else if (key == "--tile")
+        tile = std::max<std::size_t>(1, benchmark::parse_size(value));
+      else if (key == "--depth")
+        depth = std::max<std::size_t>(1, benchmark::parse_size(value));
+      else if (key == "--check")
+        check = true;
+      else
+        throw std::invalid_argument { "Unknown option " + arg };
+    }
+  }
+};
+
+
+/// The initial values, small integers so that the results are exact
+float init_a(std::size_t i) { return i % 1000; }
+float init_b(std::size_t i) { return 2*(i % 1000); }
+
+
+/// Create an input file tile by tile, keeping the memory bounded
+template <typename Init>
+void generate(const std::string &path, std::size_t n, std::size_t tile,
+              Init init) {
+  memory::mapped_file f { path, n*sizeof(float) };
+  auto p = static_cast<float *>(f.data());
+  for (std::size_t offset = 0; offset < n; offset += tile) {
+    auto end = std::min(n, offset + tile);
+    for (auto i = offset; i < end; ++i)
+      p[i] = init(i);
+    f.release(offset*sizeof(float), (end - offset)*sizeof(float));
+  }
+}
+
+
+/// Create an additional in-order queue, profiled if requested
+ocl::command_queue make_queue(ocl::runtime &rt) {
+  auto properties = ocl::profiler::instance().queue_properties(NULL);
+  cl_int status;
+  ocl::command_queue q {
+    clCreateCommandQueueWithProperties(rt.context(), rt.device(),
+                                       properties.data(), &status)
+  };
+  ocl::check(status, "clCreateCommandQueueWithProperties");
+  return q;
+}
+
+
+int main(int argc, char *argv[]) {
+  parameters p { argc, argv };
+  if (p.generate) {
+    generate(p.a, p.generate, p.tile, init_a);
+    generate(p.b, p.generate, p.tile, init_b);
+  }
+  memory::mapped_file a { p.a }, b { p.b };
+  if (a.size() != b.size() || a.size() % sizeof(float))
+    THROW_ERROR("The input files are not arrays of floats of the same size");
+  const auto n = a.size()/sizeof(float);
+  memory::mapped_file c { p.c, a.size() };
+  auto host_a = static_cast<const float *>(a.data());
+  auto host_b = static_cast<const float *>(b.data());
+  auto host_c = static_cast<float *>(c.data());
+
+  ocl::runtime rt;
+  std::clog << ocl::device_info(rt.device(), CL_DEVICE_NAME) << std::endl;
+  auto kernel = rt.kernel(kernel_source, "vector_add");
+  // The kernels run on the queue of the runtime
+  auto write_queue = make_queue(rt);
+  auto read_queue = make_queue(rt);
+
+  // The pool of device buffers, 1 set per tile in flight
+  const auto tile_bytes = p.tile*sizeof(float);
+  std::vector<ocl::mem> ba, bb, bc;
+  for (std::size_t i = 0; i < p.depth; ++i) {
+    ba.push_back(ocl::create_buffer(rt.context(), CL_MEM_READ_ONLY,
+                                    tile_bytes));
+    bb.push_back(ocl::create_buffer(rt.context(), CL_MEM_READ_ONLY,
+                                    tile_bytes));
+    bc.push_back(ocl::create_buffer(rt.context(), CL_MEM_WRITE_ONLY,
+                                    tile_bytes));
+  }
+  // The read back of the tile using each set of buffers
+  std::vector<ocl::event> read(p.depth);
+
+  // Release the host pages of a tile once it has been read back
+  auto release = [&] (std::size_t tile) {
+    auto offset = tile*tile_bytes;
+    for (auto f : { &a, &b, &c })
+      f->release(offset, tile_bytes);
+  };
+
+  const auto tiles = (n + p.tile - 1)/p.tile;
+  auto start = benchmark::clock::now();
+  a.will_need(0, tile_bytes);
+  b.will_need(0, tile_bytes);
+  for (std::size_t k = 0; k < tiles; ++k) {
+    auto slot = k % p.depth;
+    auto offset = k*p.tile;
+    const std::size_t size = std::min(p.tile, n - offset);
+    auto bytes = size*sizeof(float);
+    if (k >= p.depth) {
+      // The buffers are free once the previous tile using them is read
+      cl_event e = read[slot];
+      ocl::check(clWaitForEvents(1, &e), "clWaitForEvents");
+      release(k - p.depth);
+    }
+    // Read the next tile ahead from the disk during the transfers
+    a.will_need(offset*sizeof(float) + tile_bytes, tile_bytes);
+    b.will_need(offset*sizeof(float) + tile_bytes, tile_bytes);
+
+    cl_event written[2], computed, e;
+    ocl::check(clEnqueueWriteBuffer(write_queue, ba[slot], CL_FALSE, 0,
+                                    bytes, host_a + offset, 0, NULL,
+                                    &written[0]),
+               "clEnqueueWriteBuffer");
+    ocl::event owner_a { written[0] };
+    ocl::check(clEnqueueWriteBuffer(write_queue, bb[slot], CL_FALSE, 0,
+                                    bytes, host_b + offset, 0, NULL,
+                                    &written[1]),
+               "clEnqueueWriteBuffer");
+    ocl::event owner_b { written[1] };
+    ocl::profile("write a", written[0]);
+    ocl::profile("write b", written[1]);
+
+    ocl::set_args(kernel, ba[slot], bb[slot], bc[slot]);
+    ocl::check(clEnqueueNDRangeKernel(rt.queue(), kernel, 1, NULL, &size,
+                                      NULL, 2, written, &computed),
+               "clEnqueueNDRangeKernel");
+    ocl::event owner_computed { computed };
+    ocl::profile("vector_add", computed);
+
+    // Write the results directly into the mapped output file
+    ocl::check(clEnqueueReadBuffer(read_queue, bc[slot], CL_FALSE, 0, bytes,
+                                   host_c + offset, 1, &computed, &e),
+               "clEnqueueReadBuffer");
+    read[slot] = ocl::event { e };
+    ocl::profile("read c", e);
+
+    // Submit the commands now instead of when a queue is full
+    for (cl_command_queue q : { write_queue.get(), rt.queue(),
+                                read_queue.get() })
+      ocl::check(clFlush(q), "clFlush");
+  }
+  ocl::check(clFinish(read_queue), "clFinish");
+  for (auto k = tiles - std::min(tiles, p.depth); k < tiles; ++k)
+    release(k);
+  auto time = benchmark::seconds(start, benchmark::clock::now());
+
+  std::cout << n << " elements in " << tiles << " tiles of " << p.tile
+            << " with " << p.depth << " in flight: " << time << " s, "
+            << 3*a.size()/time*1e-9 << " GB/s, peak RSS "
+            << memory::peak_rss()/(1 << 20) << " MiB" << std::endl;
+
+  if (p.check)
+    for (std::size_t offset = 0; offset < n; offset += p.tile) {
+      auto end = std::min(n, offset + p.tile);
+      for (auto i = offset; i < end; ++i)
+        if (host_c[i] != host_a[i] + host_b[i])
+          THROW_ERROR("Wrong result at " + std::to_string(i));
+      release(offset/p.tile);
+    }
+  ocl::profiler::instance().report();
+}
@@ -0,0 +1,159 @@
+/* Vector addition with an auto-tuned launch shape
+
+   For each problem size, the work-group size, the number of vectors
+   per work-item and the width of the floatN vectors are looked up in
+   the tuning database of opencl_autotune.hpp. On the first run for a
+   device and a size bucket, all the candidate shapes are measured with
+   the profiling timestamps of the kernel and the fastest one is saved,
+   so the next runs use it immediately.
+
+   Usage: opencl_vector_add_tuned [options]
+     --size=N,M...   numbers of elements (default 1Mi,16Mi)
+     --repeat=R      timed runs per shape (default 5)
+     --retune        measure the shapes even if they are already known
+
+   The device can be chosen with the environment variables of
+   opencl_runtime.hpp. Output as CSV.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "opencl_autotune.hpp"
+#include "opencl_runtime.hpp"
+
+// The elements beyond the whole vectors are done by the first work-item
+const char kernel_source[] = R"(
+#define CONCAT_(a, b) a##b
+#define CONCAT(a, b) CONCAT_(a, b)
+#if WIDTH == 1
+#define LOAD(i, p) (p)[i]
+#define STORE(v, i, p) ((p)[i] = (v))
+#else
+#define LOAD(i, p) CONCAT(vload, WIDTH)(i, p)
+#define STORE(v, i, p) CONCAT(vstore, WIDTH)(v, i, p)
+#endif
+
+__kernel void vector_add(const __global float *a,
+                         const __global float *b,
+                         __global float *c,
+                         const ulong n) {
+  const size_t vectors = n / WIDTH;
+  for (int j = 0; j != ITEMS; ++j) {
+    size_t v = get_global_id(0) + j*get_global_size(0);
+    if (v < vectors)
+      STORE(LOAD(v, a) + LOAD(v, b), v, c);
+  }
+  if (get_global_id(0) == 0)
+    for (size_t i = vectors*WIDTH; i < n; ++i)
+      c[i] = a[i] + b[i];
+}
+)";
+
+
+/// The kernel time in seconds from the profiling timestamps of an event
+double kernel_seconds(cl_event e) {
+  cl_ulong start, end;
+  ocl::check(clWaitForEvents(1, &e), "clWaitForEvents");
+  ocl::check(clGetEventProfilingInfo(e, CL_PROFILING_COMMAND_START,
+                                     sizeof(start), &start, NULL),
+             "clGetEventProfilingInfo");
+  ocl::check(clGetEventProfilingInfo(e, CL_PROFILING_COMMAND_END,
+                                     sizeof(end), &end, NULL),
+             "clGetEventProfilingInfo");
+  return (end - start)*1e-9;
+}
+
+
+int main(int argc, char *argv[]) {
+  std::vector<std::size_t> sizes;
+  int repeat = 5;
+  bool retune = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto option = benchmark::split_option(arg);
+    auto &key = option.first;
+    auto &value = option.second;
+    if (key == "--size")
+      for (auto s : benchmark::split(value))
+        sizes.push_back(benchmark::parse_size(s));
+    else if (key == "--repeat")
+      repeat = std::max(1, std::stoi(value));
+    else if (key == "--retune")
+      retune = true;
+    else
+      throw std::invalid_argument { "Unknown option " + arg };
+  }
+  if (sizes.empty())
+    sizes = { 1 << 20, 1 << 24 };
+
+  // The kernel times come from the events, so profile the queue
+  const cl_queue_properties properties[] = {
+    CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0
+  };
+  ocl::runtime rt { ocl::select_device(), properties };
+  std::clog << ocl::device_info(rt.device(), CL_DEVICE_NAME) << std::endl;
+  ocl::tuning_database db;
+
+  std::cout << "size,bucket,local,items,width,tuned,kernel_s,bandwidth_GBps"
+            << std::endl;
+  for (auto n : sizes) {
+    std::vector<float> a(n), b(n), c(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      a[i] = i % 1000;
+      b[i] = 2*(i % 1000);
+    }
+    auto bytes = n*sizeof(float);
+    auto buffer_a = ocl::create_buffer(rt.context(),
+                                       CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                       bytes, a.data());
+    auto buffer_b = ocl::create_buffer(rt.context(),
+                                       CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                       bytes, b.data());
+    auto buffer_c = ocl::create_buffer(rt.context(), CL_MEM_WRITE_ONLY,
+                                       bytes);
+
+    /* Run the kernel with some shape and return the best time of the
+       repetitions, after 1 untimed run building it */
+    auto run = [&] (const ocl::launch_shape &s) {
+      auto k = rt.kernel(kernel_source, "vector_add", s.options());
+      ocl::set_args(k, buffer_a, buffer_b, buffer_c, cl_ulong { n });
+      const std::size_t global = s.global(n);
+      const std::size_t local = s.local;
+      auto best = 0.;
+      for (int r = 0; r <= repeat; ++r) {
+        cl_event e;
+        ocl::check(clEnqueueNDRangeKernel(rt.queue(), k, 1, NULL, &global,
+                                          local ? &local : NULL, 0, NULL, &e),
+                   "clEnqueueNDRangeKernel");
+        ocl::event owner { e };
+        auto t = kernel_seconds(e);
+        if (r == 1 || (r > 1 && t < best))
+          best = t;
+      }
+      return best;
+    };
+
+    bool tuned;
+    auto shape = ocl::tune(db, ocl::tuning_key(rt.device(), "vector_add", n),
+                           ocl::tuning_candidates(rt.device(), n), run,
+                           retune, &tuned);
+    auto time = run(shape);
+    ocl::check(clEnqueueReadBuffer(rt.queue(), buffer_c, CL_TRUE, 0, bytes,
+                                   c.data(), 0, NULL, NULL),
+               "clEnqueueReadBuffer");
+    for (std::size_t i = 0; i < n; ++i)
+      if (c[i] != a[i] + b[i])
+        THROW_ERROR("Wrong result with " + std::to_string(n) + " elements");
+    std::clog << n << " elements: " << shape
+              << (tuned ? " (tuned)" : " (from the database)") << std::endl;
+    std::cout << n << ',' << ocl::size_bucket(n) << ',' << shape.local << ','
+              << shape.items << ',' << shape.width << ',' << tuned << ','
+              << time << ',' << 3*bytes/time*1e-9 << std::endl;
+  }
+}
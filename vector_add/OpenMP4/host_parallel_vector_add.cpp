@@ -0,0 +1,133 @@
+/** Vector addition on the host cores with OpenMP, NUMA-aware
+
+    parallel_vector_add.cpp offloads to a target device, which without
+    any device runs the loop on the host, maybe on only 1 thread. This
+    is the host variant, which sweeps over the problem sizes and the
+    thread counts.
+
+    On a multi-socket node the bandwidth depends on where the pages
+    are: Linux allocates a page on the NUMA node of the thread touching
+    it first. So the arrays are initialized by the same threads, with
+    the same static schedule and the same thread placement as the
+    addition, and each thread streams the pages of its own node. The
+    threads are spread over the places, to use all the memory
+    controllers even with few threads, for example with
+      OMP_PLACES=cores ./host_parallel_vector_add --threads=1,2,4,8,16
+
+    The bandwidth is compared with the STREAM add roofline, which is
+    the same operation on doubles. It can be given with --roofline=GB/s
+    from a STREAM run on the node, or it is measured with all the
+    threads on 3 arrays of 256 MiB, far bigger than the caches as STREAM
+    requires, whatever the sizes of the sweep.
+
+    Usage: host_parallel_vector_add [benchmark options]
+                                    [--threads=T,U...] [--roofline=GB/s]
+    with the results as CSV or JSON, and the fraction of the roofline
+    on the error output.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "benchmark.hpp"
+
+/// The number of doubles per array to measure the roofline, 256 MiB
+constexpr std::size_t roofline_size = std::size_t { 1 } << 25;
+
+/// Write the arrays from the threads which will use them
+template <typename T>
+void first_touch(T *a, T *b, T *c, std::size_t n, int threads) {
+#pragma omp parallel for simd num_threads(threads) proc_bind(spread) \
+                              schedule(static)
+  for (std::size_t i = 0; i < n; ++i) {
+    // Small integers so that the results are exact
+    a[i] = i % 1000;
+    b[i] = 2*(i % 1000);
+    c[i] = 0;
+  }
+}
+
+
+/// c = a + b, with the same distribution as first_touch()
+template <typename T>
+void add(const T *a, const T *b, T *c, std::size_t n, int threads) {
+#pragma omp parallel for simd num_threads(threads) proc_bind(spread) \
+                              schedule(static)
+  for (std::size_t i = 0; i < n; ++i)
+    c[i] = a[i] + b[i];
+}
+
+
+/** Measure the addition on n elements with some threads
+
+    The arrays are allocated without being initialized, so that no page
+    is touched before first_touch().
+*/
+template <typename T>
+benchmark::result measure(const benchmark::options &o, std::size_t n,
+                          int threads, const std::string &name) {
+  std::unique_ptr<T[]> a { new T[n] }, b { new T[n] }, c { new T[n] };
+  first_touch(a.get(), b.get(), c.get(), n, threads);
+  auto samples = benchmark::measure(o, [&] {
+      benchmark::sample s;
+      {
+        benchmark::stopwatch sw { s.kernel };
+        add(a.get(), b.get(), c.get(), n, threads);
+      }
+      return s;
+    });
+  for (std::size_t i = 0; i < n; ++i)
+    if (c[i] != a[i] + b[i])
+      throw std::runtime_error { "Wrong result" };
+  return { name, n, 3*n*sizeof(T), samples };
+}
+
+
+int main(int argc, char *argv[]) {
+  benchmark::options o { argc, argv };
+  std::vector<int> thread_counts;
+  double roofline = 0;
+  for (auto &arg : o.extra) {
+    auto option = benchmark::split_option(arg);
+    auto &key = option.first;
+    auto &value = option.second;
+    if (key == "--threads")
+      for (auto t : benchmark::split(value))
+        thread_counts.push_back(std::max(1, std::stoi(t)));
+    else if (key == "--roofline")
+      roofline = std::stod(value);
+    else
+      throw std::invalid_argument { "Unknown option " + arg };
+  }
+  auto max_threads = omp_get_max_threads();
+  if (thread_counts.empty()) {
+    // The powers of 2 up to all the threads
+    for (int t = 1; t < max_threads; t *= 2)
+      thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+  }
+  if (roofline <= 0) {
+    auto r = measure<double>(o, roofline_size, max_threads, "stream_add");
+    roofline = r.bandwidth(r.median);
+    std::cerr << "Measured STREAM add roofline with " << max_threads
+              << " threads: " << roofline << " GB/s" << std::endl;
+  }
+
+  benchmark::reporter report { std::cout, o.format };
+  for (auto n : o.sizes())
+    for (auto t : thread_counts) {
+      auto r = measure<float>(o, n, t,
+                              "openmp_spread_" + std::to_string(t));
+      report(r);
+      std::cerr << n << " elements with " << t << " threads: "
+                << 100*r.bandwidth(r.median)/roofline
+                << " % of the STREAM add roofline" << std::endl;
+    }
+}
@@ -10,7 +10,7 @@ int main() {
 
 #pragma omp target parallel for map(to: a[:], b[:]) \
                                 map(from: c[:])
-  for (auto i = 0; i < N; ++i)
+  for (std::size_t i = 0; i < N; ++i)
     c[i] = a[i] + b[i];
 
   std::cout << std::endl << "Result:" << std::endl;
@@ -1,10 +1,16 @@
 /* Simple OpenCL vector addition using Boost.Compute C++ host API and
-   precompiled kernel */
+   precompiled kernel
+
+   Run with OPENCL_PROFILE=trace.json to get a trace and a summary of
+   the OpenCL commands, see opencl_profiler.hpp.
+*/
 
 #include <boost/compute.hpp>
 #include <iostream>
 #include <iterator>
 
+#include "opencl_profiler.hpp"
+
 constexpr size_t N = 3;
 using Vector = float[N];
 
@@ -27,8 +33,11 @@ int main() {
 
   // Create the OpenCL context to attach resources on the device
   auto context = boost::compute::system::default_context();
-  // Create the OpenCL command queue to control the device
-  auto command_queue = boost::compute::system::default_queue();
+  /* Create the OpenCL command queue to control the device, with
+     profiling if requested */
+  boost::compute::command_queue command_queue {
+    context, context.get_device(), ocl::profiler::instance().queue_flags()
+  };
 
   // The input buffers for OpenCL
   boost::compute::buffer buffer_a { context, sizeof(a), CL_MEM_READ_ONLY };
@@ -46,10 +55,12 @@ int main() {
   auto kernel = boost::compute::kernel { program, "vector_add" };
 
   // Send the input data to the accelerator
-  command_queue.enqueue_write_buffer(buffer_a, 0 /* Offset */,
-                                      sizeof(a), &a[0]);
-  command_queue.enqueue_write_buffer(buffer_b, 0 /* Offset */,
-                                      sizeof(b), &b[0]);
+  ocl::profile("write a",
+               command_queue.enqueue_write_buffer(buffer_a, 0 /* Offset */,
+                                                  sizeof(a), &a[0]));
+  ocl::profile("write b",
+               command_queue.enqueue_write_buffer(buffer_b, 0 /* Offset */,
+                                                  sizeof(b), &b[0]));
 
   kernel.set_args(buffer_a, buffer_b, buffer_c);
 
@@ -58,14 +69,18 @@ int main() {
   // Use only 1 CU
   boost::compute::extents<1> local { N };
   // Launch the kernel
-  command_queue.enqueue_nd_range_kernel(kernel, offset, global, local);
+  ocl::profile("vector_add",
+               command_queue.enqueue_nd_range_kernel(kernel, offset, global,
+                                                     local));
 
   // Get the output data from the accelerator
-  command_queue.enqueue_read_buffer(buffer_c, 0 /* Offset */,
-                                    sizeof(c), &c[0]);
+  ocl::profile("read c",
+               command_queue.enqueue_read_buffer(buffer_c, 0 /* Offset */,
+                                                 sizeof(c), &c[0]));
 
   std::cout << std::endl << "Result:" << std::endl;
   for(auto e : c)
     std::cout << e << " ";
   std::cout << std::endl;
+  ocl::profiler::instance().report();
 }
@@ -0,0 +1,284 @@
+/* An iterated pipeline of SYCL kernels without host synchronization
+
+   Each iteration runs 3 dependent kernels on persistent data:
+
+     c = a + b;  d = 2*c;  a = d - c - b;
+
+   which leaves a unchanged, so the result is known after any number of
+   iterations. The buffers or allocations are created once and reused
+   by all the iterations, the kernels are only chained by their
+   dependencies on the device side, and the host waits only once at the
+   end. The results are checked afterwards, outside of the measurement.
+
+   Measuring the throughput against the number of iterations shows the
+   fixed cost of the final synchronization being amortized, and running
+   with --sync=each, which waits for each kernel as the host would do
+   with a host_accessor or a scope exit at each step, shows how much of
+   the latency is avoidable synchronization.
+
+   Usage: pipelined_vector_add [options]
+     --size=N              number of elements (default 4Mi)
+     --iterations=I,J...   iteration counts (default 1,10,100,1000)
+     --memory=M            buffer (default) with accessors making the
+                           dependencies implicitly, or usm with device
+                           allocations and explicit event dependencies
+     --queue=Q             in_order (default) or out_of_order
+     --sync=S              end (default) or each
+     --device=D            cpu (default), gpu or default
+
+   Output as CSV.
+*/
+
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "benchmark.hpp"
+
+struct parameters {
+  std::size_t size = 1 << 22;
+  std::vector<std::size_t> iterations;
+  std::string memory = "buffer";
+  std::string queue = "in_order";
+  std::string sync = "end";
+  std::string device = "cpu";
+
+  parameters(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto option = benchmark::split_option(arg);
+      auto &key = option.first;
+      auto &value = option.second;
+      if (key == "--size")
+        size = benchmark::parse_size(value);
+      else if (key == "--iterations")
+        for (auto s : benchmark::split(value))
+          iterations.push_back(benchmark::parse_size(s));
+      else if (key == "--memory" && (value == "buffer" || value == "usm"))
+        memory = value;
+      else if (key == "--queue"
+               && (value == "in_order" || value == "out_of_order"))
+        queue = value;
+      else if (key == "--sync" && (value == "end" || value == "each"))
+        sync = value;
+      else if (key == "--device")
+        device = value;
+      else
+        throw std::invalid_argument { "Unknown option " + arg };
+    }
+    if (iterations.empty())
+      iterations = { 1, 10, 100, 1000 };
+  }
+};
+
+
+/// The queue on the requested device, in order or not
+sycl::queue make_queue(const parameters &p) {
+  auto properties = p.queue == "in_order"
+    ? sycl::property_list { sycl::property::queue::in_order {} }
+    : sycl::property_list {};
+  if (p.device == "cpu")
+    return sycl::queue { sycl::cpu_selector_v, properties };
+  if (p.device == "gpu")
+    return sycl::queue { sycl::gpu_selector_v, properties };
+  return sycl::queue { sycl::default_selector_v, properties };
+}
+
+
+/// The initial values, small integers so that the results are exact
+float init_a(std::size_t i) { return i % 1000; }
+float init_b(std::size_t i) { return 2*(i % 1000); }
+
+
+/** The pipeline on buffers, the accessors telling the runtime the
+    dependencies between the kernels */
+class buffer_pipeline {
+  sycl::queue &q;
+  std::size_t n;
+  sycl::buffer<float> a { n }, b { n }, c { n }, d { n };
+
+public:
+
+  buffer_pipeline(sycl::queue &q, std::size_t n) : q { q }, n { n } {
+    // The initialization is not measured
+    sycl::host_accessor ha { a, sycl::write_only, sycl::no_init };
+    sycl::host_accessor hb { b, sycl::write_only, sycl::no_init };
+    for (std::size_t i = 0; i < n; ++i) {
+      ha[i] = init_a(i);
+      hb[i] = init_b(i);
+    }
+  }
+
+  /// Submit 1 iteration, waiting for each kernel only if asked
+  void iterate(bool sync_each) {
+    q.submit([&](sycl::handler &cgh) {
+      sycl::accessor ka { a, cgh, sycl::read_only };
+      sycl::accessor kb { b, cgh, sycl::read_only };
+      sycl::accessor kc { c, cgh, sycl::write_only, sycl::no_init };
+      cgh.parallel_for(sycl::range<1> { n }, [=](sycl::id<1> i) {
+        kc[i] = ka[i] + kb[i];
+      });
+    });
+    if (sync_each)
+      q.wait();
+    q.submit([&](sycl::handler &cgh) {
+      sycl::accessor kc { c, cgh, sycl::read_only };
+      sycl::accessor kd { d, cgh, sycl::write_only, sycl::no_init };
+      cgh.parallel_for(sycl::range<1> { n }, [=](sycl::id<1> i) {
+        kd[i] = 2*kc[i];
+      });
+    });
+    if (sync_each)
+      q.wait();
+    q.submit([&](sycl::handler &cgh) {
+      sycl::accessor kb { b, cgh, sycl::read_only };
+      sycl::accessor kc { c, cgh, sycl::read_only };
+      sycl::accessor kd { d, cgh, sycl::read_only };
+      sycl::accessor ka { a, cgh, sycl::write_only, sycl::no_init };
+      cgh.parallel_for(sycl::range<1> { n }, [=](sycl::id<1> i) {
+        ka[i] = kd[i] - kc[i] - kb[i];
+      });
+    });
+    if (sync_each)
+      q.wait();
+  }
+
+  /// Wait for all the iterations, which is the only wait for the device
+  void wait() { q.wait(); }
+
+  /// Check the results once the iterations are done
+  bool check() {
+    sycl::host_accessor ha { a, sycl::read_only };
+    sycl::host_accessor hd { d, sycl::read_only };
+    for (std::size_t i = 0; i < n; ++i)
+      if (ha[i] != init_a(i) || hd[i] != 2*(init_a(i) + init_b(i)))
+        return false;
+    return true;
+  }
+};
+
+
+/** The pipeline on device allocations, chaining the kernels only with
+    their events */
+class usm_pipeline {
+  sycl::queue &q;
+  std::size_t n;
+  float *a, *b, *c, *d;
+  // The last kernel of the previous iteration
+  sycl::event last;
+
+public:
+
+  usm_pipeline(sycl::queue &q, std::size_t n)
+    : q { q }
+    , n { n }
+    , a { sycl::malloc_device<float>(n, q) }
+    , b { sycl::malloc_device<float>(n, q) }
+    , c { sycl::malloc_device<float>(n, q) }
+    , d { sycl::malloc_device<float>(n, q) } {
+    if (!a || !b || !c || !d)
+      throw std::runtime_error { "Cannot allocate the device memory" };
+    std::vector<float> ha(n), hb(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      ha[i] = init_a(i);
+      hb[i] = init_b(i);
+    }
+    // The initialization is not measured
+    q.memcpy(a, ha.data(), n*sizeof(float));
+    q.memcpy(b, hb.data(), n*sizeof(float));
+    q.wait();
+  }
+
+  ~usm_pipeline() {
+    for (auto p : { a, b, c, d })
+      sycl::free(p, q);
+  }
+
+  usm_pipeline(const usm_pipeline &) = delete;
+
+  /** Submit 1 iteration
+
+      Each kernel depends on the previous one. The first one, which
+      overwrites c, also depends on the last kernel of the previous
+      iteration, which is the last one to read c and to write a.
+  */
+  void iterate(bool sync_each) {
+    // Do not capture this in the kernels
+    auto a = this->a, b = this->b, c = this->c, d = this->d;
+    auto e = q.parallel_for(sycl::range<1> { n }, last, [=](sycl::id<1> i) {
+      c[i] = a[i] + b[i];
+    });
+    if (sync_each)
+      e.wait();
+    e = q.parallel_for(sycl::range<1> { n }, e, [=](sycl::id<1> i) {
+      d[i] = 2*c[i];
+    });
+    if (sync_each)
+      e.wait();
+    last = q.parallel_for(sycl::range<1> { n }, e, [=](sycl::id<1> i) {
+      a[i] = d[i] - c[i] - b[i];
+    });
+    if (sync_each)
+      last.wait();
+  }
+
+  /// Wait for all the iterations, which is the only wait for the device
+  void wait() { last.wait(); }
+
+  /// Check the results once the iterations are done
+  bool check() {
+    std::vector<float> ha(n), hd(n);
+    auto ea = q.memcpy(ha.data(), a, n*sizeof(float), last);
+    auto ed = q.memcpy(hd.data(), d, n*sizeof(float), last);
+    sycl::event::wait({ ea, ed });
+    for (std::size_t i = 0; i < n; ++i)
+      if (ha[i] != init_a(i) || hd[i] != 2*(init_a(i) + init_b(i)))
+        return false;
+    return true;
+  }
+};
+
+
+/// Run the pipeline for each iteration count
+template <typename Pipeline>
+void sweep(const parameters &p, sycl::queue &q) {
+  Pipeline pipeline { q, p.size };
+  // Compile the kernels and warm up before measuring
+  pipeline.iterate(false);
+  pipeline.wait();
+  // Each iteration reads 6 vectors and writes 3
+  auto bytes = 9*p.size*sizeof(float);
+  for (auto iterations : p.iterations) {
+    auto start = benchmark::clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+      pipeline.iterate(p.sync == "each");
+    pipeline.wait();
+    auto time = benchmark::seconds(start, benchmark::clock::now());
+    // Verified outside of the measurement
+    if (!pipeline.check())
+      throw std::runtime_error { "Wrong result" };
+    std::cout << p.memory << ',' << p.queue << ',' << p.sync << ','
+              << p.size << ',' << iterations << ',' << time << ','
+              << iterations/time << ',' << iterations*bytes/time*1e-9
+              << std::endl;
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  parameters p { argc, argv };
+  auto q = make_queue(p);
+  std::cerr << "Running on "
+            << q.get_device().get_info<sycl::info::device::name>()
+            << std::endl;
+  std::cout << "memory,queue,sync,size,iterations,time_s,iterations_per_s,"
+               "bandwidth_GBps" << std::endl;
+  if (p.memory == "usm")
+    sweep<usm_pipeline>(p, q);
+  else
+    sweep<buffer_pipeline>(p, q);
+}
@@ -0,0 +1,34 @@
+/** The interface of the vector addition implementations compared by
+    vector_add_benchmark
+*/
+
+#ifndef VECTOR_ADD_BENCHMARK_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_BACKEND_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "benchmark.hpp"
+
+/** An implementation of c = a + b
+
+    Each implementation keeps its own state (context, buffers,
+    compiled kernels...) across the runs so that only the steady state
+    is measured by the repetitions.
+*/
+class backend {
+
+public:
+
+  virtual ~backend() = default;
+
+  /// The name used in the reports and to select the implementation
+  virtual std::string name() const = 0;
+
+  /** Compute c = a + b on n elements and return the time spent in the
+      transfers and in the kernel */
+  virtual benchmark::sample run(const float *a, const float *b, float *c,
+                                std::size_t n) = 0;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/** Vector addition with Boost.Compute, the same way as
+    ../Boost.Compute/opencl_vector_add.cpp does it
+
+    The device can be chosen with the BOOST_COMPUTE_DEFAULT_* environment
+    variables.
+*/
+
+#ifndef VECTOR_ADD_BENCHMARK_BOOST_COMPUTE_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_BOOST_COMPUTE_BACKEND_HPP
+
+#include <boost/compute.hpp>
+
+#include "backend.hpp"
+
+class boost_compute_backend : public backend {
+  // Create the OpenCL context to attach resources on the device
+  boost::compute::context context = boost::compute::system::default_context();
+  // Create the OpenCL command queue to control the device
+  boost::compute::command_queue command_queue =
+    boost::compute::system::default_queue();
+  boost::compute::kernel kernel;
+  // The buffers are kept from one run to the other with the same size
+  boost::compute::buffer buffer_a, buffer_b, buffer_c;
+  std::size_t buffer_size = 0;
+
+public:
+
+  boost_compute_backend() {
+    auto program = boost::compute::program::create_with_source(R"(
+      __kernel void vector_add(const __global float *a,
+                               const __global float *b,
+                               __global float *c) {
+        c[get_global_id(0)] = a[get_global_id(0)] + b[get_global_id(0)];
+      }
+      )", context);
+    program.build();
+    kernel = boost::compute::kernel { program, "vector_add" };
+  }
+
+  std::string name() const override { return "boost_compute"; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    auto size = n*sizeof(float);
+    if (n != buffer_size) {
+      buffer_a = boost::compute::buffer { context, size, CL_MEM_READ_ONLY };
+      buffer_b = boost::compute::buffer { context, size, CL_MEM_READ_ONLY };
+      buffer_c = boost::compute::buffer { context, size, CL_MEM_WRITE_ONLY };
+      kernel.set_args(buffer_a, buffer_b, buffer_c);
+      buffer_size = n;
+    }
+    benchmark::sample s;
+    {
+      benchmark::stopwatch sw { s.transfer };
+      command_queue.enqueue_write_buffer(buffer_a, 0 /* Offset */, size, a);
+      command_queue.enqueue_write_buffer(buffer_b, 0 /* Offset */, size, b);
+    }
+    {
+      benchmark::stopwatch sw { s.kernel };
+      // Let the runtime choose the work-group size
+      command_queue.enqueue_1d_range_kernel(kernel, 0, n, 0);
+      command_queue.finish();
+    }
+    {
+      benchmark::stopwatch sw { s.transfer };
+      command_queue.enqueue_read_buffer(buffer_c, 0 /* Offset */, size, c);
+    }
+    return s;
+  }
+};
+
+#endif
@@ -0,0 +1,26 @@
+/** Plain sequential vector addition on the host, as a reference */
+
+#ifndef VECTOR_ADD_BENCHMARK_HOST_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_HOST_BACKEND_HPP
+
+#include "backend.hpp"
+
+class host_backend : public backend {
+
+public:
+
+  std::string name() const override { return "host"; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    benchmark::sample s;
+    {
+      benchmark::stopwatch sw { s.kernel };
+      for (std::size_t i = 0; i < n; ++i)
+        c[i] = a[i] + b[i];
+    }
+    return s;
+  }
+};
+
+#endif
@@ -0,0 +1,105 @@
+/** Vector addition with the plain OpenCL C API, the same way as
+    ../OpenCL/opencl_vector_add.cpp does it
+*/
+
+#ifndef VECTOR_ADD_BENCHMARK_OPENCL_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_OPENCL_BACKEND_HPP
+
+#include <string>
+
+#include "backend.hpp"
+#include "opencl_runtime.hpp"
+
+/** The OpenCL objects shared by the plain OpenCL implementations, set
+    up once
+
+    The device can be chosen with the environment variables of
+    opencl_runtime.hpp.
+*/
+class opencl_base : public backend {
+
+protected:
+
+  ocl::runtime rt;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue command_queue;
+  cl_kernel kernel;
+
+  /// Launch the kernel on n work-items and wait for its completion
+  void run_kernel(std::size_t n) {
+    const size_t global_work_size { n };
+    OCL_ERROR(clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL,
+                                     &global_work_size, NULL,
+                                     0, NULL, NULL));
+    OCL_ERROR(clFinish(command_queue));
+  }
+
+public:
+
+  opencl_base()
+    : context { rt.context() }
+    , device { rt.device() }
+    , command_queue { rt.queue() } {
+    const char kernel_source[] = R"(
+__kernel void vector_add(const __global float *a,
+                         const __global float *b,
+                         __global float *c) {
+  c[get_global_id(0)] = a[get_global_id(0)] + b[get_global_id(0)];
+}
+)";
+    kernel = rt.kernel(kernel_source, "vector_add");
+  }
+};
+
+
+/// Vector addition with explicit copies between host and device buffers
+class opencl_backend : public opencl_base {
+  /* The buffers come from the pool of the runtime and are kept from one
+     run to the other with the same size class */
+  ocl::buffer_pool::buffer buffer_a, buffer_b, buffer_c;
+  std::size_t size_class = 0;
+
+  void allocate_buffers(std::size_t n) {
+    auto size = n*sizeof(float);
+    if (ocl::buffer_pool::size_class(size) == size_class)
+      return;
+    // Give back the previous buffers before asking for the new ones
+    for (auto b : { &buffer_a, &buffer_b, &buffer_c })
+      b->recycle();
+    buffer_a = rt.buffers().acquire(size, CL_MEM_READ_ONLY);
+    buffer_b = rt.buffers().acquire(size, CL_MEM_READ_ONLY);
+    buffer_c = rt.buffers().acquire(size, CL_MEM_WRITE_ONLY);
+    size_class = ocl::buffer_pool::size_class(size);
+    ocl::set_args(kernel, buffer_a, buffer_b, buffer_c);
+  }
+
+public:
+
+  std::string name() const override { return "opencl"; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    allocate_buffers(n);
+    benchmark::sample s;
+    {
+      benchmark::stopwatch sw { s.transfer };
+      OCL_ERROR(clEnqueueWriteBuffer(command_queue, buffer_a, true, 0,
+                                     n*sizeof(float), a, 0, NULL, NULL));
+      OCL_ERROR(clEnqueueWriteBuffer(command_queue, buffer_b, true, 0,
+                                     n*sizeof(float), b, 0, NULL, NULL));
+    }
+    {
+      benchmark::stopwatch sw { s.kernel };
+      run_kernel(n);
+    }
+    {
+      benchmark::stopwatch sw { s.transfer };
+      OCL_ERROR(clEnqueueReadBuffer(command_queue, buffer_c, true, 0,
+                                    n*sizeof(float), c, 0, NULL, NULL));
+    }
+    return s;
+  }
+};
+
+#endif
@@ -0,0 +1,137 @@
+/** Vector addition with the plain OpenCL C API without explicit copies
+
+    On CPU and integrated devices the host memory is the device memory,
+    so the copies done by opencl_backend are pure overhead.
+*/
+
+#ifndef VECTOR_ADD_BENCHMARK_OPENCL_ZERO_COPY_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_OPENCL_ZERO_COPY_BACKEND_HPP
+
+#include <cstring>
+
+#include "opencl_backend.hpp"
+
+/** Wrap the host arrays into buffers with CL_MEM_USE_HOST_PTR and map the
+    output back instead of copying anything
+
+    The host arrays need to be page-aligned for the implementation to
+    use them directly, which is what the benchmark driver does. The
+    transfer time is then only the buffer creation and the map/unmap
+    synchronization.
+*/
+class opencl_use_host_ptr_backend : public opencl_base {
+
+  ocl::mem wrap(const float *p, std::size_t n, cl_mem_flags flags) {
+    return ocl::create_buffer(context, flags | CL_MEM_USE_HOST_PTR,
+                              n*sizeof(float), const_cast<float *>(p));
+  }
+
+public:
+
+  std::string name() const override { return "opencl_use_host_ptr"; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    benchmark::sample s;
+    ocl::mem buffer_a, buffer_b, buffer_c;
+    {
+      benchmark::stopwatch sw { s.transfer };
+      buffer_a = wrap(a, n, CL_MEM_READ_ONLY);
+      buffer_b = wrap(b, n, CL_MEM_READ_ONLY);
+      buffer_c = wrap(c, n, CL_MEM_WRITE_ONLY);
+      ocl::set_args(kernel, buffer_a, buffer_b, buffer_c);
+    }
+    {
+      benchmark::stopwatch sw { s.kernel };
+      run_kernel(n);
+    }
+    {
+      benchmark::stopwatch sw { s.transfer };
+      /* Mapping is required to have the output coherent in the host
+         memory, but this is a no-op on a shared memory device */
+      cl_int status;
+      auto p = clEnqueueMapBuffer(command_queue, buffer_c, CL_TRUE,
+                                  CL_MAP_READ, 0, n*sizeof(float),
+                                  0, NULL, NULL, &status);
+      OCL_TEST_ERROR_MSG(status, "Cannot map buffer_c");
+      OCL_ERROR(clEnqueueUnmapMemObject(command_queue, buffer_c, p,
+                                        0, NULL, NULL));
+      OCL_ERROR(clFinish(command_queue));
+      // The buffers wrapping the host arrays are released here
+      buffer_a = buffer_b = buffer_c = {};
+    }
+    return s;
+  }
+};
+
+
+/** Use coarse-grain shared virtual memory from OpenCL 2.x
+
+    The SVM allocations are kept across the runs and accessed by the host
+    through map/unmap. Since the benchmark driver owns the input and
+    output arrays, the host has to copy them in and out of the SVM
+    allocations; an application producing and consuming its data
+    directly in SVM has no copy at all.
+*/
+class opencl_svm_backend : public opencl_base {
+  ocl::svm_ptr<float> svm_a, svm_b, svm_c;
+  std::size_t svm_size = 0;
+
+  /// Execute some host code on a mapped SVM area
+  template <typename F>
+  void with_mapped(float *p, std::size_t n, cl_map_flags flags, F f) {
+    OCL_ERROR(clEnqueueSVMMap(command_queue, CL_TRUE, flags, p,
+                              n*sizeof(float), 0, NULL, NULL));
+    f();
+    OCL_ERROR(clEnqueueSVMUnmap(command_queue, p, 0, NULL, NULL));
+  }
+
+public:
+
+  opencl_svm_backend() {
+    cl_device_svm_capabilities caps;
+    OCL_ERROR(clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES,
+                              sizeof(caps), &caps, NULL));
+    if (!(caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER))
+      THROW_ERROR("The device does not support coarse-grain SVM");
+  }
+
+  std::string name() const override { return "opencl_svm"; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    if (n != svm_size) {
+      svm_a = ocl::svm_alloc<float>(context, n);
+      svm_b = ocl::svm_alloc<float>(context, n);
+      svm_c = ocl::svm_alloc<float>(context, n);
+      svm_size = n;
+      OCL_ERROR(clSetKernelArgSVMPointer(kernel, 0, svm_a.get()));
+      OCL_ERROR(clSetKernelArgSVMPointer(kernel, 1, svm_b.get()));
+      OCL_ERROR(clSetKernelArgSVMPointer(kernel, 2, svm_c.get()));
+    }
+    benchmark::sample s;
+    {
+      benchmark::stopwatch sw { s.transfer };
+      with_mapped(svm_a.get(), n, CL_MAP_WRITE_INVALIDATE_REGION, [&] {
+          std::memcpy(svm_a.get(), a, n*sizeof(float));
+        });
+      with_mapped(svm_b.get(), n, CL_MAP_WRITE_INVALIDATE_REGION, [&] {
+          std::memcpy(svm_b.get(), b, n*sizeof(float));
+        });
+    }
+    {
+      benchmark::stopwatch sw { s.kernel };
+      run_kernel(n);
+    }
+    {
+      benchmark::stopwatch sw { s.transfer };
+      with_mapped(svm_c.get(), n, CL_MAP_READ, [&] {
+          std::memcpy(c, svm_c.get(), n*sizeof(float));
+        });
+      OCL_ERROR(clFinish(command_queue));
+    }
+    return s;
+  }
+};
+
+#endif
@@ -0,0 +1,27 @@
+/** Vector addition with OpenMP on the host cores */
+
+#ifndef VECTOR_ADD_BENCHMARK_OPENMP_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_OPENMP_BACKEND_HPP
+
+#include "backend.hpp"
+
+class openmp_backend : public backend {
+
+public:
+
+  std::string name() const override { return "openmp"; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    benchmark::sample s;
+    {
+      benchmark::stopwatch sw { s.kernel };
+#pragma omp parallel for simd schedule(static)
+      for (std::size_t i = 0; i < n; ++i)
+        c[i] = a[i] + b[i];
+    }
+    return s;
+  }
+};
+
+#endif
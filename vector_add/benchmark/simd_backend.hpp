@@ -0,0 +1,52 @@
+/** Vector addition with the SIMD host library of host_simd.hpp */
+
+#ifndef VECTOR_ADD_BENCHMARK_SIMD_BACKEND_HPP
+#define VECTOR_ADD_BENCHMARK_SIMD_BACKEND_HPP
+
+#include <stdexcept>
+#include <string>
+
+#include "backend.hpp"
+#include "host_simd.hpp"
+
+/** The "simd" implementation uses the best instruction set of the
+    processor, "simd_sse2", "simd_avx2" and "simd_avx512" a given one,
+    and "simd_temporal" never uses non-temporal stores, to show what
+    they bring beyond the last-level cache */
+class simd_backend : public backend {
+  simd::isa isa;
+  simd::store store;
+  std::string n;
+
+public:
+
+  simd_backend()
+    : isa { simd::best() }
+    , store { simd::store::automatic }
+    , n { "simd" } {}
+
+  explicit simd_backend(simd::isa i,
+                        simd::store s = simd::store::automatic)
+    : isa { i }
+    , store { s }
+    , n { std::string { "simd_" }
+          + (s == simd::store::temporal ? "temporal" : simd::name(i)) } {
+    if (!simd::supported(i))
+      throw std::domain_error { std::string { "The processor does not "
+          "support " } + simd::name(i) };
+  }
+
+  std::string name() const override { return n; }
+
+  benchmark::sample run(const float *a, const float *b, float *c,
+                        std::size_t n) override {
+    benchmark::sample s;
+    {
+      benchmark::stopwatch sw { s.kernel };
+      simd::add(a, b, c, n, store, isa);
+    }
+    return s;
+  }
+};
+
+#endif
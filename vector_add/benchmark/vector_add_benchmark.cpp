@@ -0,0 +1,123 @@
+/** Compare the vector addition implementations over a range of sizes
+
+    For example
+      ./vector_add_benchmark --min=1Ki --max=256Mi --format=json
+      ./vector_add_benchmark --backend=openmp,opencl --repeat=20
+
+    reports for each implementation and size the median and 99th
+    percentile latencies, the median transfer and kernel times, and the
+    effective bandwidth in GB/s, counting the 2 vectors read and the
+    vector written.
+
+    The fastest implementation for each size is also displayed on the
+    error output. To compare the SIMD host library with the OpenCL CPU
+    device, for example:
+      OPENCL_DEVICE_TYPE=cpu ./vector_add_benchmark --backend=simd,opencl
+
+    The OpenCL implementations are compiled only if OpenCL is available,
+    see the Makefile. An implementation which cannot be initialized at
+    run time, for example without any OpenCL platform, is skipped with a
+    message on the error output.
+
+    The MPI and SYCL versions need their own compiler and launcher, so
+    they are not part of this driver.
+*/
+
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+#include "benchmark.hpp"
+
+#include "host_backend.hpp"
+#include "openmp_backend.hpp"
+#include "simd_backend.hpp"
+#ifdef BENCHMARK_OPENCL
+#include "opencl_backend.hpp"
+#include "opencl_zero_copy_backend.hpp"
+#include "boost_compute_backend.hpp"
+#endif
+
+/** Instantiate an implementation if it is selected and can be
+    initialized, with some optional constructor arguments
+
+    The selection is checked from the name first, so that an
+    implementation not selected does not even create its OpenCL context.
+*/
+template <typename Backend, typename... Args>
+void add(std::vector<std::unique_ptr<backend>> &backends,
+         const benchmark::options &o, const std::string &name,
+         Args &&... args) {
+  if (!o.selected(name))
+    return;
+  try {
+    backends.emplace_back(new Backend(std::forward<Args>(args)...));
+  } catch (std::exception &e) {
+    std::cerr << "Skipping an implementation: " << e.what() << std::endl;
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  benchmark::options o { argc, argv };
+
+  std::vector<std::unique_ptr<backend>> backends;
+  add<host_backend>(backends, o, "host");
+  add<openmp_backend>(backends, o, "openmp");
+  add<simd_backend>(backends, o, "simd");
+  for (auto i : { simd::isa::sse2, simd::isa::avx2, simd::isa::avx512 })
+    add<simd_backend>(backends, o, std::string { "simd_" } + simd::name(i),
+                      i);
+  add<simd_backend>(backends, o, "simd_temporal", simd::best(),
+                    simd::store::temporal);
+#ifdef BENCHMARK_OPENCL
+  add<opencl_backend>(backends, o, "opencl");
+  add<opencl_use_host_ptr_backend>(backends, o, "opencl_use_host_ptr");
+  add<opencl_svm_backend>(backends, o, "opencl_svm");
+  add<boost_compute_backend>(backends, o, "boost_compute");
+#endif
+
+  benchmark::reporter report { std::cout, o.format };
+  for (auto n : o.sizes()) {
+    /* Page-aligned host memory, so that zero-copy implementations can
+       use it directly */
+    std::vector<float, memory::aligned_allocator<float>> a(n), b(n), c(n);
+    // Use small integers so that the float results are exact
+    for (std::size_t i = 0; i < n; ++i) {
+      a[i] = i % 1000;
+      b[i] = 2*(i % 1000);
+    }
+    // The fastest implementation for this size
+    std::string fastest;
+    auto fastest_time = std::numeric_limits<double>::infinity();
+    for (auto &be : backends) {
+      try {
+        std::fill(c.begin(), c.end(), 0);
+        auto samples = benchmark::measure(o, [&] {
+            return be->run(a.data(), b.data(), c.data(), n);
+          });
+        for (std::size_t i = 0; i < n; ++i)
+          if (c[i] != a[i] + b[i])
+            throw std::runtime_error { "Wrong result" };
+        benchmark::result r { be->name(), n, 3*n*sizeof(float), samples };
+        report(r);
+        if (r.median < fastest_time) {
+          fastest = r.backend;
+          fastest_time = r.median;
+        }
+      } catch (std::exception &e) {
+        std::cerr << be->name() << " with " << n << " elements: "
+                  << e.what() << std::endl;
+      }
+    }
+    if (!fastest.empty())
+      std::cerr << "Fastest with " << n << " elements: " << fastest
+                << std::endl;
+  }
+}